@@ -0,0 +1,167 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <functional>
+#include <string_view>
+#include <memory_resource>
+
+/* Open addressing string -> 32 bit value index (Robin Hood hashing).
+The index only stores the value and the precomputed hash of its key; the key itself lives
+with the caller, which passes a keyOf(value) accessor on every call. Probing compares the
+stored hashes and only looks at a key when they are equal, so a lookup is a linear walk over
+one contiguous array, almost always within the same cache line.
+Erase shifts the following displaced slots one step back (backward shift deletion): no
+tombstones, so probe lengths don't degrade on books with heavy add/cancel churn. */
+class FlatIndex
+{
+public:
+  struct Slot
+  {
+    std::uint32_t hash;
+    std::uint32_t value;
+  };
+
+private:
+  //Per slot probe distance + 1, 0 means empty. A separate byte array keeps the probe loop tight.
+  std::pmr::vector<std::uint8_t> dist;
+  std::pmr::vector<Slot> slots;
+  size_t count{0};
+  size_t mask{0};
+
+  static constexpr size_t maxDist = 255;
+
+  /* Purpose: place an entry known to be absent. Returns false when the probe distance overflows,
+  slot then holds whichever entry was left without a place. */
+  bool place(Slot& slot)
+  {
+    size_t d = 1;
+    for (size_t i = slot.hash & mask; ; i = (i + 1) & mask, ++d)
+    {
+      if (d >= maxDist) return false;
+      if (dist[i] == 0)
+      {
+        dist[i] = static_cast<std::uint8_t>(d);
+        slots[i] = slot;
+        return true;
+      }
+      if (dist[i] < d)
+      {
+        //Robin Hood: the richer entry gives up its slot and goes on probing.
+        std::swap(slots[i], slot);
+        auto displaced = dist[i];
+        dist[i] = static_cast<std::uint8_t>(d);
+        d = displaced;
+      }
+    }
+  }
+  void rehash(size_t capacity)
+  {
+    auto oldDist = std::move(dist);
+    auto oldSlots = std::move(slots);
+    while (true)
+    {
+      dist.assign(capacity, 0);
+      slots.assign(capacity, Slot{0, 0});
+      mask = capacity - 1;
+
+      bool ok = true;
+      for (size_t i = 0; i < oldDist.size() && ok; ++i)
+      {
+        auto slot = oldSlots[i];
+        if (oldDist[i]) ok = place(slot);
+      }
+      if (ok) return;
+      capacity *= 2;
+    }
+  }
+  template <typename KeyOf>
+  size_t findSlot(std::string_view key, std::uint32_t hash, const KeyOf& keyOf) const
+  {
+    if (count == 0) return npos;
+    size_t d = 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask, ++d)
+    {
+      //An entry closer to its home than we are to ours means the key is not here.
+      if (dist[i] < d) return npos;
+      if (slots[i].hash == hash && keyOf(slots[i].value) == key) return i;
+    }
+  }
+
+public:
+  static constexpr size_t npos = ~size_t{0};
+  static constexpr std::uint32_t nvalue = ~std::uint32_t{0};
+
+  explicit FlatIndex(std::pmr::memory_resource* r = std::pmr::get_default_resource()) : dist(r), slots(r) {}
+
+  static std::uint32_t hashOf(std::string_view key)
+  {
+    //Fold a 64 bit hash into 32 bits; through uint64_t so the shift stays defined where size_t is 32 bit.
+    std::uint64_t h = std::hash<std::string_view>{}(key);
+    return static_cast<std::uint32_t>(h ^ (h >> 32));
+  }
+
+  size_t size() const { return count; }
+  size_t capacity() const { return slots.size(); }
+
+  /* Raw tables, for snapshots: a table written out and given back to restore() needs no rehash,
+  as long as it is read by a build with the same hashOf() (checked by the snapshot header). */
+  const std::pmr::vector<std::uint8_t>& distTable() const { return dist; }
+  const std::pmr::vector<Slot>& slotTable() const { return slots; }
+  void restore(const void* distBytes, const void* slotBytes, size_t capacity, size_t n)
+  {
+    //Raw bytes, e.g. straight from a mapped file with no alignment guarantee.
+    dist.resize(capacity);
+    slots.resize(capacity);
+    if (capacity)
+    {
+      std::memcpy(dist.data(), distBytes, capacity);
+      std::memcpy(slots.data(), slotBytes, capacity * sizeof(Slot));
+    }
+    mask = capacity ? capacity - 1 : 0;
+    count = n;
+  }
+
+  void reserve(size_t n)
+  {
+    size_t capacity = 16;
+    while (capacity * 4 < n * 5) capacity *= 2;
+    if (capacity > slots.size()) rehash(capacity);
+  }
+  template <typename KeyOf>
+  std::uint32_t find(std::string_view key, const KeyOf& keyOf) const
+  {
+    auto i = findSlot(key, hashOf(key), keyOf);
+    return i == npos ? nvalue : slots[i].value;
+  }
+  //Purpose: insert key -> value, returns false (and changes nothing) when the key is already in.
+  template <typename KeyOf>
+  bool insert(std::string_view key, std::uint32_t value, const KeyOf& keyOf)
+  {
+    auto hash = hashOf(key);
+    if (findSlot(key, hash, keyOf) != npos) return false;
+
+    //Keep the load under 80%, Robin Hood probe lengths stay short up to there.
+    if ((count + 1) * 5 > slots.size() * 4) rehash(slots.empty() ? 16 : slots.size() * 2);
+    Slot slot{hash, value};
+    while (!place(slot)) rehash(slots.size() * 2);
+    ++count;
+    return true;
+  }
+  template <typename KeyOf>
+  bool erase(std::string_view key, const KeyOf& keyOf)
+  {
+    auto i = findSlot(key, hashOf(key), keyOf);
+    if (i == npos) return false;
+
+    for (auto next = (i + 1) & mask; dist[next] > 1; i = next, next = (next + 1) & mask)
+    {
+      slots[i] = slots[next];
+      dist[i] = static_cast<std::uint8_t>(dist[next] - 1);
+    }
+    dist[i] = 0;
+    --count;
+    return true;
+  }
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <algorithm>
+
+/* Log-linear latency histogram (HDR style): values below 2^SubBits ns each get their own bucket,
+above that every power of two is split in 2^(SubBits-1) equal buckets, so a percentile is
+off by at most 1/2^(SubBits-1) of its value (~3% with the default 6 bits) over the whole range.
+Recording is an index computation and an increment, no allocation; the max is kept exact.
+Values over ~18 minutes land in the last bucket. */
+template <unsigned SubBits = 6>
+class LatencyHistogram
+{
+  static constexpr std::uint64_t subCount = 1ull << SubBits;
+  static constexpr std::uint64_t half = subCount / 2;
+  static constexpr unsigned maxBits = 40;
+  static constexpr size_t bucketCount = subCount + (maxBits - SubBits + 1) * half;
+
+  std::array<std::uint64_t, bucketCount> counts{};
+  std::uint64_t total{0};
+  std::uint64_t maxValue{0};
+
+  static unsigned msb(std::uint64_t v)
+  {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63u - static_cast<unsigned>(__builtin_clzll(v));
+#else
+    unsigned bit = 0;
+    while (v >>= 1) ++bit;
+    return bit;
+#endif
+  }
+  static size_t bucketOf(std::uint64_t v)
+  {
+    if (v < subCount) return static_cast<size_t>(v);
+    auto shift = msb(v) - (SubBits - 1);
+    auto bucket = subCount + (shift - 1) * half + ((v >> shift) - half);
+    return static_cast<size_t>(std::min<std::uint64_t>(bucket, bucketCount - 1));
+  }
+  //Purpose: the highest value that lands in bucket.
+  static std::uint64_t upperOf(size_t bucket)
+  {
+    if (bucket < subCount) return bucket;
+    auto shift = (bucket - subCount) / half + 1;
+    auto top = half + (bucket - subCount) % half;
+    return ((top + 1) << shift) - 1;
+  }
+
+public:
+  void record(std::uint64_t ns)
+  {
+    ++counts[bucketOf(ns)];
+    ++total;
+    maxValue = std::max(maxValue, ns);
+  }
+  void reset()
+  {
+    counts.fill(0);
+    total = 0;
+    maxValue = 0;
+  }
+
+  std::uint64_t count() const { return total; }
+  std::uint64_t max() const { return maxValue; }
+  //Purpose: the value at or under which a fraction q (0..1) of the recorded values are, 0 when empty.
+  std::uint64_t percentile(double q) const
+  {
+    if (total == 0) return 0;
+    auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5);
+    rank = std::max<std::uint64_t>(rank, 1);
+    std::uint64_t seen{0};
+    for (size_t bucket = 0; bucket < bucketCount; ++bucket)
+    {
+      seen += counts[bucket];
+      //The last bucket also holds everything over the range, only the max is known there.
+      if (seen >= rank) return bucket == bucketCount - 1 ? maxValue : std::min(upperOf(bucket), maxValue);
+    }
+    return maxValue;
+  }
+};
+
+//What stats() reports for one operation, in nanoseconds.
+struct LatencySummary
+{
+  std::uint64_t count{0};
+  std::uint64_t p50{0};
+  std::uint64_t p99{0};
+  std::uint64_t p999{0};
+  std::uint64_t max{0};
+
+  template <unsigned SubBits>
+  static LatencySummary of(const LatencyHistogram<SubBits>& h)
+  {
+    return LatencySummary{h.count(), h.percentile(0.5), h.percentile(0.99), h.percentile(0.999), h.max()};
+  }
+};
+inline std::ostream& operator<<(std::ostream& out, const LatencySummary& s)
+{
+  return out << s.count << " ops, p50 " << s.p50 << " ns, p99 " << s.p99 << " ns, p99.9 " << s.p999 << " ns, max " << s.max << " ns";
+}
+
+//Purpose: time a scope into a histogram (steady_clock, a vDSO call on Linux: ~20 ns per read).
+template <typename Histogram>
+class LatencyTimer
+{
+  Histogram& histogram;
+  std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+
+public:
+  explicit LatencyTimer(Histogram& h) : histogram(h) {}
+  ~LatencyTimer()
+  {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    histogram.record(static_cast<std::uint64_t>(ns));
+  }
+  LatencyTimer(const LatencyTimer&) = delete;
+  LatencyTimer& operator=(const LatencyTimer&) = delete;
+};
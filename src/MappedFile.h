@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <fstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define ORDERCACHE_HAS_MMAP 1
+#elif defined(_WIN32)
+#include <io.h>
+#endif
+
+/* Read only view of a whole file. On POSIX the file is memory mapped, so nothing is read until
+a page is touched and the pages come straight from the page cache; elsewhere (or when mmap
+fails) the file is read into a buffer. ok() is false when the file can't be opened or read;
+an empty file is ok() with a size() of 0 (and data() may then be null). */
+class MappedFile
+{
+  const char* bytes{nullptr};
+  size_t length{0};
+  bool mapped{false};
+  bool opened{false};
+  std::vector<char> buffer{};
+
+public:
+  explicit MappedFile(const std::string& path)
+  {
+#ifdef ORDERCACHE_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st{};
+    if (::fstat(fd, &st) != 0)
+    {
+      ::close(fd);
+      return;
+    }
+    //An empty file has nothing to map (mmap of 0 bytes fails).
+    auto p = st.st_size > 0 ? ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (p != MAP_FAILED)
+    {
+      ::madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+      bytes = static_cast<const char*>(p);
+      length = static_cast<size_t>(st.st_size);
+      mapped = true;
+    }
+    ::close(fd);
+    opened = mapped || st.st_size == 0;
+    if (opened) return;
+#endif
+    std::ifstream in{path, std::ios::binary};
+    if (!in) return;
+    buffer.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+    if (in.bad()) return;
+    bytes = buffer.data();
+    length = buffer.size();
+    opened = true;
+  }
+  ~MappedFile()
+  {
+#ifdef ORDERCACHE_HAS_MMAP
+    if (mapped) ::munmap(const_cast<char*>(bytes), length);
+#endif
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool ok() const { return opened; }
+  const char* data() const { return bytes; }
+  size_t size() const { return length; }
+};
+
+//Purpose: push what was written to f down to the disk. False where no write can be made durable.
+inline bool syncFile(std::FILE* f)
+{
+#if defined(ORDERCACHE_HAS_MMAP)
+  return ::fsync(::fileno(f)) == 0;
+#elif defined(_WIN32)
+  return ::_commit(::_fileno(f)) == 0;
+#else
+  (void)f;
+  return false;
+#endif
+}
+//Purpose: make a file created or renamed into path's directory durable, by fsyncing the directory.
+inline bool syncDirectoryOf(const std::string& path)
+{
+#if defined(ORDERCACHE_HAS_MMAP)
+  auto slash = path.find_last_of('/');
+  auto dir = slash == std::string::npos ? std::string{"."} : path.substr(0, slash == 0 ? 1 : slash);
+  int fd = ::open(dir.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  bool ok = ::fsync(fd) == 0;
+  ::close(fd);
+  return ok;
+#elif defined(_WIN32)
+  //NTFS journals its directory entries, there is no directory handle to flush.
+  (void)path;
+  return true;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+//Bounds checked cursor over raw bytes (e.g. a MappedFile), values are memcpy'd out so any alignment goes.
+struct ByteReader
+{
+  const char* p;
+  const char* end;
+
+  template <typename T>
+  bool read(T& v)
+  {
+    if (static_cast<size_t>(end - p) < sizeof(T)) return false;
+    std::memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+  }
+  //Purpose: skip over n elements of T, returns where they start or nullptr when the bytes run out.
+  template <typename T>
+  const char* take(std::uint64_t n)
+  {
+    if (n > static_cast<size_t>(end - p) / sizeof(T)) return nullptr;
+    auto at = p;
+    p += n * sizeof(T);
+    return at;
+  }
+};
@@ -1,13 +1,23 @@
 #pragma once
 #include <set>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
 #include <utility>
 #include <iomanip>
+#include <iterator>
 #include <iostream>
 #include <algorithm>
 #include <functional>
+#include <memory_resource>
 #include <unordered_map>
+#include "FlatIndex.h"
+#include "SlabArena.h"
+#include "LatencyStats.h"
+#include "SymbolTable.h"
+#include "TrackingResource.h"
+#include "WorkStealingPool.h"
 
 class Order
 {
@@ -41,28 +51,22 @@ class Order
 
 public:
   Order(){} /*Why!?: So we can use the [] operator*/
-  Order(const Order& o) : m_orderId{o.orderId()}, m_securityId{o.securityId()}, m_side{o.side()}, m_qty{o.qty()}, m_user{o.user()}, m_company{o.company()} {}    
-  Order& operator=(const Order& o) 
-  { 
-    m_orderId = o.orderId();
-    m_securityId = o.securityId();
-    m_side = o.side();
-    m_qty = o.qty();
-    m_user = o.user();
-    m_company = o.company();
-    return *this; 
-  }
-  Order& operator=(Order&& o)
-  {
-    m_orderId = std::move(o.orderId());
-    m_securityId = std::move(o.securityId());
-    m_side = std::move(o.side());
-    m_qty = std::move(o.qty());
-    m_user = std::move(o.user());
-    m_company = std::move(o.company());
-    return *this; 
+  Order(std::string&& ordId, std::string&& secId, std::string&& side, const unsigned int qty, std::string&& user, std::string&& company)
+   : m_orderId(std::move(ordId)), m_securityId(std::move(secId)), m_side(std::move(side)), m_qty(qty), m_user(std::move(user)), m_company(std::move(company)) { }
 
-  }
+  /* Copy and move work on the members: the accessors above return copies, going through them
+  made every move a copy. */
+  Order(const Order& o) = default;
+  Order(Order&& o) noexcept = default;
+  Order& operator=(const Order& o) = default;
+  Order& operator=(Order&& o) noexcept = default;
+
+  //Internal use: no copy, the reference is valid as long as the Order is.
+  const std::string& orderIdRef() const    { return m_orderId; }
+  const std::string& securityIdRef() const { return m_securityId; }
+  const std::string& sideRef() const       { return m_side; }
+  const std::string& userRef() const       { return m_user; }
+  const std::string& companyRef() const    { return m_company; }
 
 };
 
@@ -99,163 +103,938 @@ public:
 
 
 using namespace std;
-using UserOrdersid = unordered_map<string, set<string>>;
-using SecuritiesOrdersid = unordered_map<string, set<string>>;
+using OrderHandle = uint32_t;
+constexpr OrderHandle noOrder = ~OrderHandle{0};
 using OrderidSecurity = unordered_map<string, string>;
-using OrdersidOrder = unordered_map<string, Order>;
 
-class OrderCache : public OrderCacheInterface, public OrdersidOrder 
+/* Internal order record, what the cache keeps per order on the hot paths.
+Names are interned symbols and the side is an enum: 20 bytes against the six strings of an Order.
+Order objects are only built back at the API boundary (getOrder, getAllOrders), forEachOrder()
+hands out views instead. */
+enum class Side : uint8_t { Buy, Sell };
+struct OrderRecord
+{
+  Symbol securityId;
+  Symbol user;
+  Symbol company;
+  unsigned int qty;
+  Side side;
+};
+static_assert(sizeof(OrderRecord) <= 32, "OrderRecord is meant to stay within half a cache line");
+
+/* Intrusive doubly linked lists of orders (per user, per security). The links are threaded
+through the arena entries, so membership costs no node and unlinking is O(1) in place. */
+struct OrderLinks
+{
+  OrderHandle prev{noOrder};
+  OrderHandle next{noOrder};
+};
+struct OrderList
+{
+  OrderHandle head{noOrder};
+  uint32_t size{0};
+};
+using UserOrdersid = pmr::vector<OrderList>;
+using SecuritiesOrdersid = pmr::vector<OrderList>;
+
+//Arena slot of an order: its record, the order id (from the cache memory resource) and list links.
+struct OrderEntry
 {
-  UserOrdersid user_ordersid{};
+  OrderRecord record{};
+  pmr::string orderId;
+  bool live{false};
+  uint32_t generation{0};
+  OrderLinks userLinks{};
+  OrderLinks secLinks{};
 
-  SecuritiesOrdersid sec_ordersid{};
+  explicit OrderEntry(pmr::memory_resource* r) : orderId(r) {}
+};
+using OrderArena = SlabArena<OrderEntry>;
+
+/* Per security index of the orders sorted by qty, for cancelOrdersForSecIdWithMinimumQty().
+Adds go to an unsorted pending tail and are merged in on the next query. Cancels don't touch
+the index: an entry whose (handle, generation) no longer names a live order is stale, and stale
+entries are dropped by the next compaction or when they fall in a cancelled qty range.
+A query is O(log n + k) on top of merging what was added since the previous one. */
+struct QtyEntry
+{
+  unsigned int qty;
+  OrderHandle h;
+  uint32_t generation;
+};
+class QtyIndex
+{
+  pmr::vector<QtyEntry> sorted;
+  pmr::vector<QtyEntry> pending;
+  size_t stale{0};
+
+  //Purpose: merge the pending tail in, through scratch so no temporary buffer is allocated.
+  void flush(pmr::vector<QtyEntry>& scratch)
+  {
+    if (pending.empty()) return;
+    auto byQty = [](const QtyEntry& a, const QtyEntry& b) { return a.qty < b.qty; };
+    sort(pending.begin(), pending.end(), byQty);
+    scratch.resize(sorted.size() + pending.size());
+    merge(sorted.begin(), sorted.end(), pending.begin(), pending.end(), scratch.begin(), byQty);
+    sorted.swap(scratch);
+    pending.clear();
+  }
 
 public:
+  using allocator_type = pmr::polymorphic_allocator<QtyEntry>;
 
-  //Purpose: to make test
-  set<string> getUserOrders(string userId)
+  explicit QtyIndex(const allocator_type& a = {}) : sorted(a), pending(a) {}
+  QtyIndex(const QtyIndex& o, const allocator_type& a) : sorted(o.sorted, a), pending(o.pending, a), stale(o.stale) {}
+  QtyIndex(QtyIndex&& o, const allocator_type& a) : sorted(std::move(o.sorted), a), pending(std::move(o.pending), a), stale(o.stale) {}
+
+  //Snapshot support: the live entries sorted by qty, and assign() to take them back.
+  template <typename IsLive>
+  void liveEntries(const IsLive& isLive, vector<QtyEntry>& out) const
   {
-    return user_ordersid[userId]; 
+    out.clear();
+    for (auto& e : sorted) if (isLive(e)) out.push_back(e);
+    auto mid = out.size();
+    for (auto& e : pending) if (isLive(e)) out.push_back(e);
+    auto byQty = [](const QtyEntry& a, const QtyEntry& b) { return a.qty < b.qty; };
+    sort(out.begin() + mid, out.end(), byQty);
+    inplace_merge(out.begin(), out.begin() + mid, out.end(), byQty);
   }
-  //Purpose to test.
-  set<string> getSecs()
+  void assign(const QtyEntry* first, const QtyEntry* last)
   {
-    set<string> retset{};
-    for (auto kv : sec_ordersid)
+    sorted.assign(first, last);
+    pending.clear();
+    stale = 0;
+  }
+
+  void add(const QtyEntry& e) { pending.push_back(e); }
+  void onRemove() { ++stale; }
+
+  //Compaction is worth it once most entries are stale, it is O(n) so it stays amortized O(1).
+  bool needsCompaction() const { return stale > 64 && stale * 2 > sorted.size() + pending.size(); }
+  template <typename IsLive>
+  void compact(const IsLive& isLive, pmr::vector<QtyEntry>& scratch)
+  {
+    flush(scratch);
+    sorted.erase(remove_if(sorted.begin(), sorted.end(), [&](const QtyEntry& e) { return !isLive(e); }), sorted.end());
+    stale = 0;
+  }
+
+  //Purpose: call cancel(h) for every live order with qty >= minQty and drop their entries.
+  template <typename IsLive, typename Cancel>
+  void cancelFrom(unsigned int minQty, const IsLive& isLive, const Cancel& cancel, pmr::vector<QtyEntry>& scratch)
+  {
+    flush(scratch);
+    auto first = lower_bound(sorted.begin(), sorted.end(), minQty, [](const QtyEntry& e, unsigned int qty) { return e.qty < qty; });
+    auto from = static_cast<size_t>(first - sorted.begin());
+    for (auto i = from; i < sorted.size(); ++i)
     {
-      retset.insert(kv.first);
+      if (isLive(sorted[i])) cancel(sorted[i].h);
     }
-    return retset;
+    //Every entry in the tail is stale now.
+    stale -= sorted.size() - from;
+    sorted.resize(from);
   }
+};
+using SecuritiesQtyIndex = pmr::vector<QtyIndex>;
 
-  void addOrder(Order o) override
-  {
-    /* In order to use [] operator we need to provide a default () constructor of Order,
-    however as the cache specification does not tell how to handle existing Order with
-    the same orderId, we assume that edge case is handled BEFORE the addOrder function
-    is called into the stack. 
+//Running qty totals. Kept as 64 bit so a book of many large orders can't overflow the sums.
+struct CompanyTotals
+{
+  unsigned long long buy{0};
+  unsigned long long sell{0};
+};
+struct SecurityTotals
+{
+  using allocator_type = pmr::polymorphic_allocator<pair<const Symbol, CompanyTotals>>;
 
-    However..... a failover case is implemented to ignore any
-    attempt to push in the cache any new OrderI which already exists.*/
+  unsigned long long buy{0};
+  unsigned long long sell{0};
+  pmr::unordered_map<Symbol, CompanyTotals> companies;
 
-    auto orderId = o.orderId();
-    if ((*this).find(orderId) != (*this).end()) return;
+  explicit SecurityTotals(const allocator_type& a = {}) : companies(a) {}
+  SecurityTotals(const SecurityTotals& o, const allocator_type& a) : buy(o.buy), sell(o.sell), companies(o.companies, a) {}
+  SecurityTotals(SecurityTotals&& o, const allocator_type& a) : buy(o.buy), sell(o.sell), companies(std::move(o.companies), a) {}
+};
+using SecuritiesTotals = pmr::vector<SecurityTotals>;
+using SecuritiesMatchingSize = vector<pair<string, unsigned int>>;
 
-    user_ordersid[o.user()].insert(orderId);
-    (*this)[orderId] = o;
+/* Read only view of a cached order, what forEachOrder() and viewOrders() yield instead of an
+Order copy. The views point into the cache (the arena slot and the interned names): they stay
+valid until the order is cancelled. */
+struct OrderView
+{
+  string_view orderId;
+  string_view securityId;
+  string_view side;
+  unsigned int qty;
+  string_view user;
+  string_view company;
 
-    //Securities mapping -- add order
-    auto secId = o.securityId();
-    sec_ordersid[secId].insert(orderId);
+  Order toOrder() const
+  {
+    return Order{string{orderId}, string{securityId}, string{side}, qty, string{user}, string{company}};
   }
-  void cancelOrder(const std::string& orderId ) override
+};
+//Selects orders by security, user and company, an empty name matches any.
+struct OrderFilter
+{
+  string_view securityId{};
+  string_view user{};
+  string_view company{};
+};
+
+/* Per operation latencies of an OrderCache, in ns. They are only measured in builds with
+ORDERCACHE_STATS defined: otherwise the timers compile to nothing and every count stays 0. */
+struct OrderCacheStats
+{
+#ifdef ORDERCACHE_STATS
+  static constexpr bool enabled = true;
+#else
+  static constexpr bool enabled = false;
+#endif
+  LatencySummary addOrder{};
+  LatencySummary cancelOrder{};
+  LatencySummary cancelOrdersForUser{};
+  LatencySummary cancelOrdersForSecIdWithMinimumQty{};
+  LatencySummary getMatchingSizeForSecurity{};
+  LatencySummary getAllOrders{};
+};
+inline ostream& operator<<(ostream& out, const OrderCacheStats& s)
+{
+  out << "addOrder                          : " << s.addOrder << "\n";
+  out << "cancelOrder                       : " << s.cancelOrder << "\n";
+  out << "cancelOrdersForUser               : " << s.cancelOrdersForUser << "\n";
+  out << "cancelOrdersForSecIdWithMinimumQty: " << s.cancelOrdersForSecIdWithMinimumQty << "\n";
+  out << "getMatchingSizeForSecurity        : " << s.getMatchingSizeForSecurity << "\n";
+  return out << "getAllOrders                      : " << s.getAllOrders << "\n";
+}
+#ifdef ORDERCACHE_STATS
+#define ORDERCACHE_TIMED(op) LatencyTimer<LatencyHistogram<>> op##_timer{op_latency.op}
+#else
+#define ORDERCACHE_TIMED(op)
+#endif
+
+/* Bytes held by each structure of an OrderCache, as counted by the tracking resource it
+allocates through (what was asked of the cache's resource, not an estimate). */
+struct OrderCacheMemory
+{
+  size_t orders{0};          //arena slabs (one slot per order ever live at once) and free list
+  size_t orderIds{0};        //order id strings too long for the small string buffer
+  size_t orderIndex{0};      //order id -> handle table
+  size_t userOrders{0};      //per user list heads
+  size_t securityOrders{0};  //per security list heads
+  size_t qtyIndexes{0};      //per security qty indexes
+  size_t totals{0};          //per security and company buy/sell totals
+  size_t names{0};           //interned security, user and company names
+  size_t liveOrders{0};
+
+  size_t total() const { return orders + orderIds + orderIndex + userOrders + securityOrders + qtyIndexes + totals + names; }
+  double perOrder(size_t bytes) const { return liveOrders ? static_cast<double>(bytes) / liveOrders : 0; }
+};
+inline ostream& operator<<(ostream& out, const OrderCacheMemory& m)
+{
+  auto flags = out.flags();
+  auto precision = out.precision();
+  auto line = [&](const char* what, size_t bytes)
   {
-    if ((*this).find(orderId) == (*this).end()) return;
+    out << what << ": " << setw(12) << bytes << " bytes, " << setw(8) << fixed << setprecision(1) << m.perOrder(bytes) << " per order\n";
+  };
+  line("orders         ", m.orders);
+  line("order ids      ", m.orderIds);
+  line("order id index ", m.orderIndex);
+  line("user lists     ", m.userOrders);
+  line("security lists ", m.securityOrders);
+  line("qty indexes    ", m.qtyIndexes);
+  line("totals         ", m.totals);
+  line("names          ", m.names);
+  line("total          ", m.total());
+  out.flags(flags);
+  out.precision(precision);
+  return out;
+}
+
+/* The string_view overloads of the interface methods are templates constrained to string_view:
+that way a string literal still goes to the std::string signature instead of being ambiguous. */
+template <typename T>
+using IfStringView = enable_if_t<is_same<T, string_view>::value, int>;
+
+/* Company level matching engine.
+A security's book is collapsed into per company buy/sell totals and the allocation is solved
+as a transportation problem: source -> buy side of company c (capacity buy_c), buy side of c ->
+sell side of every other company d (unbounded), sell side of d -> sink (capacity sell_d).
+A finite cut either removes the whole buy side, the whole sell side, or everything but the
+two sides of one company c (the only pair with no edge between them), so by max-flow/min-cut:
+
+    matched = min(sum buy, sum sell, sum buy + sum sell - max_c(buy_c + sell_c))
 
-    auto secid = (*this)[orderId].securityId();
-    user_ordersid.erase((*this)[orderId].user());
-    (*this).erase(orderId);
+Cost is O(#companies), independent of the number of orders and of their interleaving. */
+class MatchingEngine
+{
+public:
+  static Side sideOf(string_view side) { return side == "Buy" ? Side::Buy : Side::Sell; }
 
-    //Securities mpping -- remove order
+  static void add(SecurityTotals& secTotals, Symbol company, Side side, unsigned long long qty)
+  {
+    auto buy = side == Side::Buy;
+    auto& companyTotals = secTotals.companies[company];
+    if (buy)
+    {
+      secTotals.buy += qty;
+      companyTotals.buy += qty;
+    }
+    else
     {
-      sec_ordersid[secid].erase(orderId);
+      secTotals.sell += qty;
+      companyTotals.sell += qty;
     }
   }
-  void cancelOrdersForUser(const std::string& user) override
+  //Purpose: the inverse of add(). Emptied companies keep their (zero) entry, so churn does not allocate.
+  static void remove(SecurityTotals& secTotals, Symbol company, Side side, unsigned long long qty)
   {
-    if (user_ordersid.find(user) == user_ordersid.end()) return;
+    auto buy = side == Side::Buy;
+    auto companyIt = secTotals.companies.find(company);
+    if (companyIt == secTotals.companies.end()) return;
+    auto& companyTotals = companyIt->second;
+    if (buy)
+    {
+      secTotals.buy -= qty;
+      companyTotals.buy -= qty;
+    }
+    else
+    {
+      secTotals.sell -= qty;
+      companyTotals.sell -= qty;
+    }
+  }
 
-    auto orderIds = user_ordersid[user];
-    user_ordersid.erase(user);
+  //Collapse the orders of one security into company totals.
+  template <typename OrderIt>
+  static SecurityTotals collapse(OrderIt first, OrderIt last, const string& securityId)
+  {
+    SecurityTotals secTotals{};
+    SymbolTable companies{};
+    for (; first != last; ++first)
+    {
+      const Order& o = *first;
+      if (o.securityIdRef() != securityId) continue;
+      add(secTotals, companies.intern(o.companyRef()), sideOf(o.sideRef()), o.qty());
+    }
+    return secTotals;
+  }
 
-    for (auto& orderId : orderIds)
+  static unsigned long long solve(const SecurityTotals& secTotals)
+  {
+    unsigned long long biggestCompany{0};
+    for (auto& kv : secTotals.companies)
     {
+      biggestCompany = max(biggestCompany, kv.second.buy + kv.second.sell);
+    }
+    return min(min(secTotals.buy, secTotals.sell), secTotals.buy + secTotals.sell - biggestCompany);
+  }
+};
+
+class OrderCache : public OrderCacheInterface
+{
+  friend class OrderCacheSnapshot;
+  friend class OrderCacheColumnar;
+
+  /* Each structure allocates through its own tracker, all forwarding to the cache's resource,
+  so memoryUsage() can tell which one the memory goes to. Declared first, destroyed last. */
+  TrackingResource orders_mem;
+  TrackingResource orderids_mem;
+  TrackingResource index_mem;
+  TrackingResource userlists_mem;
+  TrackingResource seclists_mem;
+  TrackingResource qtyindex_mem;
+  TrackingResource totals_mem;
+  TrackingResource names_mem;
 
-      //Securities mpping -- remove order
-      auto secid = (*this)[orderId].securityId();
-      sec_ordersid[secid].erase(orderId);
+  //Interned names: the indexes below are dense vectors addressed by these ids.
+  SymbolTable securities;
+  SymbolTable users;
+  SymbolTable companies;
 
-      (*this).erase(orderId);
+  /* Orders live in a slab arena and are addressed by stable 32 bit handles, order_index maps an
+  order id to its handle. Handles freed by a cancel are reused by the next adds. */
+  OrderArena orders;
+  FlatIndex order_index;
+
+  UserOrdersid user_ordersid;
+
+  SecuritiesOrdersid sec_ordersid;
+
+  SecuritiesQtyIndex sec_qtyindex;
+  pmr::vector<QtyEntry> qtyindex_scratch;
+
+  /* Per security (and per company inside the security) buy and sell totals. 
+  They are updated on every add/cancel so matching never has to walk the orders. */
+  SecuritiesTotals sec_totals;
+
+  //Purpose: intern the names of a new order, growing the dense indexes to fit.
+  OrderRecord makeRecord(string_view securityId, string_view side, unsigned int qty, string_view user, string_view company)
+  {
+    auto secId = securities.intern(securityId);
+    auto userId = users.intern(user);
+    if (secId >= sec_ordersid.size())
+    {
+      sec_ordersid.resize(secId + 1);
+      sec_qtyindex.resize(secId + 1);
+      sec_totals.resize(secId + 1);
     }
+    if (userId >= user_ordersid.size()) user_ordersid.resize(userId + 1);
+
+    return OrderRecord{secId, userId, companies.intern(company), qty, MatchingEngine::sideOf(side)};
   }
-  void cancelOrdersForSecIdWithMinimumQty(const std::string& securityId, unsigned int minQty) override
+  OrderView viewOf(const OrderEntry& e) const
   {
-    if (sec_ordersid.find(securityId) == sec_ordersid.end()) return;
+    auto& r = e.record;
+    return OrderView{e.orderId, securities.name(r.securityId), r.side == Side::Buy ? "Buy" : "Sell", r.qty, users.name(r.user), companies.name(r.company)};
+  }
+  Order makeOrder(const OrderEntry& e) const
+  {
+    return viewOf(e).toOrder();
+  }
 
-    auto orderIds = sec_ordersid[securityId];
-    for (auto& orderId : orderIds)
-    {
-      auto removeCondition = (*this)[orderId].qty() >= minQty;
-      if (!removeCondition) continue;
+  void link(OrderList& list, OrderHandle h, OrderLinks OrderEntry::* links)
+  {
+    auto& l = orders[h].*links;
+    l.prev = noOrder;
+    l.next = list.head;
+    if (list.head != noOrder) (orders[list.head].*links).prev = h;
+    list.head = h;
+    ++list.size;
+  }
+  void unlink(OrderList& list, OrderHandle h, OrderLinks OrderEntry::* links)
+  {
+    auto& l = orders[h].*links;
+    if (l.prev != noOrder) (orders[l.prev].*links).next = l.next;
+    else list.head = l.next;
+    if (l.next != noOrder) (orders[l.next].*links).prev = l.prev;
+    --list.size;
+  }
 
-      user_ordersid[(*this)[orderId].user()].erase(orderId);
-      
-      //Securities mapping -- remove order
-      auto secid = (*this)[orderId].securityId();
-      sec_ordersid[secid].erase(orderId);
+  //Purpose: does a qty index entry still name a live order (its handle may have been reused).
+  auto isLive() const
+  {
+    return [this](const QtyEntry& q) { return orders[q.h].live && orders[q.h].generation == q.generation; };
+  }
 
-      (*this).erase(orderId);
+  auto orderIdOf() const
+  {
+    return [this](OrderHandle h) -> const pmr::string& { return orders[h].orderId; };
+  }
+  OrderHandle findOrder(string_view orderId) const
+  {
+    return order_index.find(orderId, orderIdOf());
+  }
 
+  //Purpose: take an arena slot and the order id for a new order, noOrder when the id is already in.
+  //The order id is copied once, into its arena slot; names are only copied the first time they are interned.
+  OrderHandle claimOrder(const Order& o)
+  {
+    return claimOrder(o.orderIdRef(), o.securityIdRef(), o.sideRef(), o.qty(), o.userRef(), o.companyRef());
+  }
+  OrderHandle claimOrder(string_view orderId, string_view securityId, string_view side, unsigned int qty, string_view user, string_view company)
+  {
+    auto h = orders.acquire();
+    auto& e = orders[h];
+    e.orderId = orderId;
+    if (!order_index.insert(e.orderId, h, orderIdOf()))
+    {
+      orders.release(h);
+      return noOrder;
     }
+
+    e.record = makeRecord(securityId, side, qty, user, company);
+    e.live = true;
+    return h;
   }
-  unsigned int getMatchingSizeForSecurity(const std::string& securityId) override
+  //Purpose: hook a claimed order into the user/security lists, the totals and the qty index.
+  void indexOrder(OrderHandle h)
   {
-    auto orderIds = sec_ordersid[securityId];
-    vector<pair<string,string>> relations{};
-    unordered_map<string, unsigned int> orderIds_qty{};
+    auto& e = orders[h];
+    auto& r = e.record;
+    link(user_ordersid[r.user], h, &OrderEntry::userLinks);
+    MatchingEngine::add(sec_totals[r.securityId], r.company, r.side, r.qty);
+
+    //Securities mapping -- add order
+    link(sec_ordersid[r.securityId], h, &OrderEntry::secLinks);
 
-    //Create qty scores map
-    for(auto& orderId : orderIds) orderIds_qty.insert(make_pair(orderId, (*this)[orderId].qty()));
-    //Create relations
-    for(auto it0 = orderIds.begin(); it0 != orderIds.end(); ++it0) for (auto it1 = next(it0, 1); it1 != orderIds.end(); ++it1)
+    auto& qtyIndex = sec_qtyindex[r.securityId];
+    if (qtyIndex.needsCompaction()) qtyIndex.compact(isLive(), qtyindex_scratch);
+    qtyIndex.add(QtyEntry{r.qty, h, ++e.generation});
+  }
+  //Purpose: the length of [first, last) for a reserve(), 0 for a single pass range that measuring would consume.
+  template <typename It>
+  static size_t sizeHint(It first, It last)
+  {
+    if constexpr (is_base_of_v<forward_iterator_tag, typename iterator_traits<It>::iterator_category>) return static_cast<size_t>(distance(first, last));
+    else return 0;
+  }
+  //Purpose: order a batch of handles by security then user, so index updates come in groups.
+  void groupBySecurityAndUser(vector<OrderHandle>& batch) const
+  {
+    sort(batch.begin(), batch.end(), [this](OrderHandle a, OrderHandle b)
     {
+      auto& ra = orders[a].record;
+      auto& rb = orders[b].record;
+      if (ra.securityId != rb.securityId) return ra.securityId < rb.securityId;
+      return ra.user != rb.user ? ra.user < rb.user : a < b;
+    });
+  }
+
+  //Purpose: single place where an order leaves the cache, so every index stays in sync.
+  void removeOrder(OrderHandle h)
+  {
+    auto& e = orders[h];
+    auto& r = e.record;
 
-      bool goodrelation = true;
-      goodrelation = goodrelation && ((*this)[*it0].side() != (*this)[*it1].side());
-      goodrelation = goodrelation && ((*this)[*it0].company() != (*this)[*it1].company());
+    unlink(user_ordersid[r.user], h, &OrderEntry::userLinks);
 
-      if (goodrelation) relations.push_back(make_pair(*it0, *it1));
+    //Securities mapping -- remove order
+    unlink(sec_ordersid[r.securityId], h, &OrderEntry::secLinks);
+    sec_qtyindex[r.securityId].onRemove();
 
+    MatchingEngine::remove(sec_totals[r.securityId], r.company, r.side, r.qty);
+    order_index.erase(e.orderId, orderIdOf());
+
+    e.live = false;
+    orders.release(h);
+  }
+
+#ifdef ORDERCACHE_STATS
+  struct OpLatencies
+  {
+    LatencyHistogram<> addOrder, cancelOrder, cancelOrdersForUser, cancelOrdersForSecIdWithMinimumQty, getMatchingSizeForSecurity, getAllOrders;
+  };
+  mutable OpLatencies op_latency{};
+#endif
+
+  unsigned int matchingSize(Symbol secId) const
+  {
+    return static_cast<unsigned int>(MatchingEngine::solve(sec_totals[secId]));
+  }
+
+public:
+
+  /* Forward iterator over the live orders matching a filter, yields OrderView.
+  With a security in the filter only that security's list is walked, else with a user only the
+  user's list, else the whole arena; the remaining names are checked on the interned ids.
+  Adding or cancelling orders invalidates the iterators. */
+  class OrderIterator
+  {
+    friend class OrderCache;
+    enum class Walk : uint8_t { Arena, Security, User };
+
+    const OrderCache* cache{nullptr};
+    OrderHandle h{noOrder};
+    Walk walk{Walk::Arena};
+    Symbol secId{SymbolTable::npos};
+    Symbol userId{SymbolTable::npos};
+    Symbol companyId{SymbolTable::npos};
+
+    bool matches() const
+    {
+      auto& e = cache->orders[h];
+      auto& r = e.record;
+      return e.live && (secId == SymbolTable::npos || r.securityId == secId)
+        && (userId == SymbolTable::npos || r.user == userId)
+        && (companyId == SymbolTable::npos || r.company == companyId);
     }
+    void step()
+    {
+      switch (walk)
+      {
+        case Walk::Arena: h = h + 1 < cache->orders.end() ? h + 1 : noOrder; break;
+        case Walk::Security: h = cache->orders[h].secLinks.next; break;
+        case Walk::User: h = cache->orders[h].userLinks.next; break;
+      }
+    }
+    void skip()
+    {
+      while (h != noOrder && !matches()) step();
+    }
+
+  public:
+    using iterator_category = forward_iterator_tag;
+    using value_type = OrderView;
+    using difference_type = ptrdiff_t;
+    using pointer = void;
+    using reference = OrderView;
 
-    unsigned int accumulator{0};
+    OrderIterator() = default;
 
-    //Calc Match
-    while(any_of(relations.begin(), relations.end(), [&](auto& rij)->bool
+    OrderView operator*() const { return cache->viewOf(cache->orders[h]); }
+    OrderIterator& operator++()
+    {
+      step();
+      skip();
+      return *this;
+    }
+    OrderIterator operator++(int)
     {
-      auto& oi = rij.first;
-      auto& oj = rij.second;
+      auto it = *this;
+      ++*this;
+      return it;
+    }
+    bool operator==(const OrderIterator& other) const { return h == other.h; }
+    bool operator!=(const OrderIterator& other) const { return h != other.h; }
+  };
+  struct OrderRange
+  {
+    OrderIterator first;
+    OrderIterator last;
+    OrderIterator begin() const { return first; }
+    OrderIterator end() const { return last; }
+  };
 
-      auto& qi = orderIds_qty[oi];
-      auto& qj = orderIds_qty[oj];
+  //Purpose: walk the orders matching filter without copying them, see OrderIterator.
+  OrderRange viewOrders(const OrderFilter& filter = {}) const
+  {
+    OrderIterator it{};
+    it.cache = this;
+    //A name the cache has never seen matches no order: the range is empty.
+    auto resolve = [](const SymbolTable& table, string_view name, Symbol& id)
+    {
+      if (name.empty()) return true;
+      id = table.find(name);
+      return id != SymbolTable::npos;
+    };
+    if (!resolve(securities, filter.securityId, it.secId) || !resolve(users, filter.user, it.userId)
+      || !resolve(companies, filter.company, it.companyId))
+    {
+      return OrderRange{it, it};
+    }
 
-      bool good = true;
+    if (it.secId != SymbolTable::npos)
+    {
+      it.walk = OrderIterator::Walk::Security;
+      it.h = sec_ordersid[it.secId].head;
+    }
+    else if (it.userId != SymbolTable::npos)
+    {
+      it.walk = OrderIterator::Walk::User;
+      it.h = user_ordersid[it.userId].head;
+    }
+    else if (orders.end() != 0)
+    {
+      it.h = 0;
+    }
+    it.skip();
 
-      good = good && ((qi * qj) > 0);
-      if (good)
-      {
-        accumulator += qi > qj ? qj : qi;
+    auto last = it;
+    last.h = noOrder;
+    return OrderRange{it, last};
+  }
+  //Purpose: call visitor(OrderView) on every order matching filter. The visitor must not add or cancel orders.
+  template <typename Visitor>
+  void forEachOrder(const OrderFilter& filter, Visitor&& visitor) const
+  {
+    for (auto view : viewOrders(filter)) visitor(view);
+  }
+  template <typename Visitor>
+  void forEachOrder(Visitor&& visitor) const
+  {
+    forEachOrder(OrderFilter{}, visitor);
+  }
 
-        int qiqj = qi - qj;
-        int qjqi = qj - qi;
+  /* All the cache storage (arena slabs, order ids, indexes, totals, names) comes from resource.
+  With a pooling resource, e.g. pmr::unsynchronized_pool_resource, a warm cache under steady
+  add/cancel traffic does no heap allocation. */
+  explicit OrderCache(pmr::memory_resource* resource = pmr::get_default_resource())
+    : orders_mem(resource), orderids_mem(resource), index_mem(resource), userlists_mem(resource), seclists_mem(resource),
+      qtyindex_mem(resource), totals_mem(resource), names_mem(resource),
+      securities(&names_mem), users(&names_mem), companies(&names_mem),
+      orders(&orders_mem, &orderids_mem), order_index(&index_mem), user_ordersid(&userlists_mem), sec_ordersid(&seclists_mem),
+      sec_qtyindex(&qtyindex_mem), qtyindex_scratch(&qtyindex_mem), sec_totals(&totals_mem) {}
 
-        qi = qiqj >= 0 ? qiqj : 0;
-        qj = qjqi >= 0 ? qjqi : 0;
-      }
+  bool hasOrder(const string& orderId) const
+  {
+    return hasOrder(string_view{orderId});
+  }
+  template <typename View, IfStringView<View> = 0>
+  bool hasOrder(View orderId) const
+  {
+    return findOrder(orderId) != FlatIndex::nvalue;
+  }
+  //Purpose: single order lookup, built back from the internal record.
+  Order getOrder(const string& orderId) const
+  {
+    return getOrder(string_view{orderId});
+  }
+  template <typename View, IfStringView<View> = 0>
+  Order getOrder(View orderId) const
+  {
+    auto h = findOrder(orderId);
+    return h == FlatIndex::nvalue ? Order{} : makeOrder(orders[h]);
+  }
+  size_t size() const { return orders.size(); }
 
-      return good;
-    }));
+  //Purpose: bytes held right now by each structure, see OrderCacheMemory.
+  OrderCacheMemory memoryUsage() const
+  {
+    OrderCacheMemory m{};
+    m.orders = orders_mem.bytes();
+    m.orderIds = orderids_mem.bytes();
+    m.orderIndex = index_mem.bytes();
+    m.userOrders = userlists_mem.bytes();
+    m.securityOrders = seclists_mem.bytes();
+    m.qtyIndexes = qtyindex_mem.bytes();
+    m.totals = totals_mem.bytes();
+    m.names = names_mem.bytes();
+    m.liveOrders = orders.size();
+    return m;
+  }
 
+  //Purpose: latency percentiles and counts per operation since construction or resetStats().
+  OrderCacheStats stats() const
+  {
+    OrderCacheStats s{};
+#ifdef ORDERCACHE_STATS
+    s.addOrder = LatencySummary::of(op_latency.addOrder);
+    s.cancelOrder = LatencySummary::of(op_latency.cancelOrder);
+    s.cancelOrdersForUser = LatencySummary::of(op_latency.cancelOrdersForUser);
+    s.cancelOrdersForSecIdWithMinimumQty = LatencySummary::of(op_latency.cancelOrdersForSecIdWithMinimumQty);
+    s.getMatchingSizeForSecurity = LatencySummary::of(op_latency.getMatchingSizeForSecurity);
+    s.getAllOrders = LatencySummary::of(op_latency.getAllOrders);
+#endif
+    return s;
+  }
+  void resetStats()
+  {
+#ifdef ORDERCACHE_STATS
+    op_latency = OpLatencies{};
+#endif
+  }
 
-    return accumulator;
+  //Purpose: to make test
+  set<string> getUserOrders(string userId)
+  {
+    set<string> retset{};
+    auto userSym = users.find(userId);
+    if (userSym == SymbolTable::npos) return retset;
+    for (auto h = user_ordersid[userSym].head; h != noOrder; h = orders[h].userLinks.next)
+    {
+      retset.insert(string{orders[h].orderId});
+    }
+    return retset;
   }
-  vector<Order> getAllOrders() const override
+  //Purpose to test.
+  set<string> getSecs()
   {
-    auto allOrders = vector<Order>{};
-    for (auto& kv : (*this))
+    set<string> retset{};
+    for (Symbol secId = 0; secId < securities.size(); ++secId)
     {
-      allOrders.push_back(kv.second);
+      retset.emplace(securities.name(secId));
     }
+    return retset;
+  }
+
+  void addOrder(Order o) override
+  {
+    ORDERCACHE_TIMED(addOrder);
+    /* In order to use [] operator we need to provide a default () constructor of Order,
+    however as the cache specification does not tell how to handle existing Order with
+    the same orderId, we assume that edge case is handled BEFORE the addOrder function
+    is called into the stack. 
+
+    However..... a failover case is implemented to ignore any
+    attempt to push in the cache any new OrderI which already exists.*/
+
+    auto h = claimOrder(o);
+    if (h != noOrder) indexOrder(h);
+  }
+  //Purpose: add an order straight from its fields (e.g. views into a parse buffer), no Order is built.
+  void emplaceOrder(string_view orderId, string_view securityId, string_view side, unsigned int qty, string_view user, string_view company)
+  {
+    ORDERCACHE_TIMED(addOrder);
+    auto h = claimOrder(orderId, securityId, side, qty, user, company);
+    if (h != noOrder) indexOrder(h);
+  }
+  /* Bulk ingest. Capacity for the whole batch is reserved up front, duplicates (against the cache
+  and inside the batch) are rejected in the same pass that claims the order ids, then the accepted
+  orders are linked grouped by security and user, so consecutive updates hit the same totals,
+  qty index and list heads. Same result as calling addOrder() on each order in turn. */
+  template <typename OrderIt>
+  void addOrders(OrderIt first, OrderIt last)
+  {
+    auto n = sizeHint(first, last);
+    orders.reserve(n);
+    order_index.reserve(order_index.size() + n);
+
+    vector<OrderHandle> batch{};
+    batch.reserve(n);
+    for (; first != last; ++first)
+    {
+      auto h = claimOrder(*first);
+      if (h != noOrder) batch.push_back(h);
+    }
+
+    groupBySecurityAndUser(batch);
+    for (auto h : batch) indexOrder(h);
+  }
+  void addOrders(const vector<Order>& os)
+  {
+    addOrders(os.begin(), os.end());
+  }
+  //Bulk cancel by order id, unknown ids are skipped like in cancelOrder().
+  template <typename OrderIdIt>
+  void cancelOrders(OrderIdIt first, OrderIdIt last)
+  {
+    vector<OrderHandle> batch{};
+    batch.reserve(sizeHint(first, last));
+    for (; first != last; ++first)
+    {
+      auto h = findOrder(*first);
+      if (h != FlatIndex::nvalue) batch.push_back(h);
+    }
+
+    groupBySecurityAndUser(batch);
+    //The same id twice in the batch gives the same handle twice: only the first one removes it.
+    batch.erase(unique(batch.begin(), batch.end()), batch.end());
+    for (auto h : batch) removeOrder(h);
+  }
+  void cancelOrders(const vector<string>& orderIds)
+  {
+    cancelOrders(orderIds.begin(), orderIds.end());
+  }
+
+  void cancelOrder(const std::string& orderId ) override
+  {
+    cancelOrder(string_view{orderId});
+  }
+  template <typename View, IfStringView<View> = 0>
+  void cancelOrder(View orderId)
+  {
+    ORDERCACHE_TIMED(cancelOrder);
+    auto h = findOrder(orderId);
+    if (h == FlatIndex::nvalue) return;
+
+    removeOrder(h);
+  }
+  void cancelOrdersForUser(const std::string& user) override
+  {
+    cancelOrdersForUser(string_view{user}, nullptr);
+  }
+  template <typename View, IfStringView<View> = 0>
+  void cancelOrdersForUser(View user)
+  {
+    cancelOrdersForUser(user, nullptr);
+  }
+  //Purpose: same as above, the ids of the cancelled orders are appended to cancelledIds (when given).
+  void cancelOrdersForUser(string_view user, vector<string>* cancelledIds)
+  {
+    ORDERCACHE_TIMED(cancelOrdersForUser);
+    auto userId = users.find(user);
+    if (userId == SymbolTable::npos) return;
+
+    //removeOrder() unlinks each order from the user's list in place, no copy of it is needed.
+    auto& userOrders = user_ordersid[userId];
+    while (userOrders.head != noOrder)
+    {
+      if (cancelledIds) cancelledIds->emplace_back(orders[userOrders.head].orderId);
+      removeOrder(userOrders.head);
+    }
+  }
+  void cancelOrdersForSecIdWithMinimumQty(const std::string& securityId, unsigned int minQty) override
+  {
+    cancelOrdersForSecIdWithMinimumQty(string_view{securityId}, minQty, nullptr);
+  }
+  template <typename View, IfStringView<View> = 0>
+  void cancelOrdersForSecIdWithMinimumQty(View securityId, unsigned int minQty)
+  {
+    cancelOrdersForSecIdWithMinimumQty(securityId, minQty, nullptr);
+  }
+  //Purpose: same as above, the ids of the cancelled orders are appended to cancelledIds (when given).
+  void cancelOrdersForSecIdWithMinimumQty(string_view securityId, unsigned int minQty, vector<string>* cancelledIds)
+  {
+    ORDERCACHE_TIMED(cancelOrdersForSecIdWithMinimumQty);
+    auto secId = securities.find(securityId);
+    if (secId == SymbolTable::npos) return;
+
+    //Only the orders with qty >= minQty are visited, found by a binary search on the qty index.
+    sec_qtyindex[secId].cancelFrom(minQty, isLive(), [&](OrderHandle h)
+    {
+      if (cancelledIds) cancelledIds->emplace_back(orders[h].orderId);
+      removeOrder(h);
+    }, qtyindex_scratch);
+  }
+  unsigned int getMatchingSizeForSecurity(const std::string& securityId) override
+  {
+    return getMatchingSizeForSecurity(string_view{securityId});
+  }
+  template <typename View, IfStringView<View> = 0>
+  unsigned int getMatchingSizeForSecurity(View securityId)
+  {
+    ORDERCACHE_TIMED(getMatchingSizeForSecurity);
+    //Only the running totals are read: O(#companies in the security), no allocation.
+    auto secId = securities.find(securityId);
+    if (secId == SymbolTable::npos) return 0;
+
+    return matchingSize(secId);
+  }
+  /* Batch matching: one sweep over the securities, one row per security in the result table.
+  The overloads taking the result table reuse its buffer, so a report polling every cycle
+  does not reallocate once the table has grown to the book size. */
+  void getMatchingSizeForAllSecurities(SecuritiesMatchingSize& result) const
+  {
+    result.resize(securities.size());
+    for (Symbol secId = 0; secId < securities.size(); ++secId)
+    {
+      result[secId].first = securities.name(secId);
+      result[secId].second = matchingSize(secId);
+    }
+  }
+  SecuritiesMatchingSize getMatchingSizeForAllSecurities() const
+  {
+    SecuritiesMatchingSize result{};
+    getMatchingSizeForAllSecurities(result);
+    return result;
+  }
+  /* Parallel batch matching: the securities are partitioned in chunks of grain across the
+  pool workers, idle workers steal the chunks left behind by workers stuck on big books.
+  Securities are independent and only read here, so no locking is involved. */
+  void getMatchingSizeForAllSecurities(WorkStealingPool& pool, SecuritiesMatchingSize& result, size_t grain = 256) const
+  {
+    result.resize(securities.size());
+    pool.parallelFor(result.size(), grain, [&](size_t begin, size_t end)
+    {
+      for (auto secId = begin; secId < end; ++secId)
+      {
+        result[secId].first = securities.name(static_cast<Symbol>(secId));
+        result[secId].second = matchingSize(static_cast<Symbol>(secId));
+      }
+    });
+  }
+  SecuritiesMatchingSize getMatchingSizeForAllSecurities(WorkStealingPool& pool) const
+  {
+    SecuritiesMatchingSize result{};
+    getMatchingSizeForAllSecurities(pool, result);
+    return result;
+  }
+  //Purpose: same as above for a given list of securities, rows follow the order of securityIds.
+  void getMatchingSizeForSecurities(const vector<string>& securityIds, SecuritiesMatchingSize& result) const
+  {
+    result.resize(securityIds.size());
+    for (size_t i = 0; i < securityIds.size(); ++i)
+    {
+      auto secId = securities.find(securityIds[i]);
+      result[i].first = securityIds[i];
+      result[i].second = secId == SymbolTable::npos ? 0 : matchingSize(secId);
+    }
+  }
+  SecuritiesMatchingSize getMatchingSizeForSecurities(const vector<string>& securityIds) const
+  {
+    SecuritiesMatchingSize result{};
+    getMatchingSizeForSecurities(securityIds, result);
+    return result;
+  }
+  vector<Order> getAllOrders() const override
+  {
+    ORDERCACHE_TIMED(getAllOrders);
+    auto allOrders = vector<Order>{};
+    allOrders.reserve(orders.size());
+    forEachOrder([&](const OrderView& o) { allOrders.push_back(o.toOrder()); });
     return allOrders;
   }
 
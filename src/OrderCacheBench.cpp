@@ -0,0 +1,466 @@
+#include "OrderCache.h"
+#include "ShardedOrderCache.h"
+#include "QueuedOrderCache.h"
+#include "OrderCacheSnapshot.h"
+#include "OrderJournal.h"
+#include "OrderCacheJson.h"
+#include "OrderWorkload.h"
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#ifdef ORDERCACHE_HAS_MMAP
+#include <sys/resource.h>
+#endif
+
+using Clock = chrono::steady_clock;
+
+double elapsedMs(Clock::time_point t0)
+{
+  return chrono::duration<double, milli>(Clock::now() - t0).count();
+}
+
+//Book with a few huge securities and a long tail of small ones.
+void fillBook(OrderCache& oc, unsigned int nOrders, unsigned int nSecurities, unsigned int nCompanies)
+{
+  std::mt19937 rng{42};
+  for (unsigned int i = 0; i < nOrders; ++i)
+  {
+    auto sec = i % 10 == 0 ? rng() % 8 : rng() % nSecurities;
+    oc.addOrder(Order("OrdId" + to_string(i), "SecId" + to_string(sec), rng() % 2 ? "Buy" : "Sell", 100 * (1 + rng() % 50), "User" + to_string(rng() % 10000), "Company" + to_string(rng() % nCompanies)));
+  }
+}
+
+void benchParallelMatching(OrderCache& oc, unsigned int maxThreads, int rounds)
+{
+  SecuritiesMatchingSize result{};
+
+  auto t0 = Clock::now();
+  for (int r = 0; r < rounds; ++r) oc.getMatchingSizeForAllSecurities(result);
+  auto sequentialMs = elapsedMs(t0) / rounds;
+  cout << "getMatchingSizeForAllSecurities sequential: " << sequentialMs << " ms" << endl;
+
+  for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+  {
+    WorkStealingPool pool{threads};
+    oc.getMatchingSizeForAllSecurities(pool, result, 64);
+
+    t0 = Clock::now();
+    for (int r = 0; r < rounds; ++r) oc.getMatchingSizeForAllSecurities(pool, result, 64);
+    auto ms = elapsedMs(t0) / rounds;
+    cout << "getMatchingSizeForAllSecurities " << setw(2) << threads << " workers: " << ms << " ms (x" << sequentialMs / ms << ")" << endl;
+  }
+}
+
+//Restart: replaying every order through addOrders() against loading a binary snapshot.
+void benchSnapshotRestart(const OrderCache& oc)
+{
+  auto allOrders = oc.getAllOrders();
+  auto t0 = Clock::now();
+  {
+    OrderCache replayed;
+    replayed.addOrders(allOrders);
+  }
+  cout << "restart by addOrders() : " << setw(8) << elapsedMs(t0) << " ms" << endl;
+
+  std::string path{"OrderCacheBench.snapshot"};
+  t0 = Clock::now();
+  OrderCacheSnapshot::save(oc, path);
+  cout << "snapshot save          : " << setw(8) << elapsedMs(t0) << " ms" << endl;
+  t0 = Clock::now();
+  {
+    OrderCache loaded;
+    auto ok = OrderCacheSnapshot::load(loaded, path);
+    cout << "restart by snapshot    : " << setw(8) << elapsedMs(t0) << " ms (" << (ok ? loaded.size() : 0) << " orders)" << endl;
+  }
+  std::remove(path.c_str());
+}
+
+//Journaled adds, fsync on: one fsync per group, so the group size sets the throughput.
+void benchJournal(unsigned int nOps)
+{
+  std::string snapshotPath{"OrderCacheBench.jsnapshot"}, journalPath{"OrderCacheBench.journal"};
+  for (size_t group : {1, 64, 1024})
+  {
+    std::remove(snapshotPath.c_str());
+    std::remove(journalPath.c_str());
+    //An fsync per add is slow enough that a short run says it all.
+    auto n = group == 1 ? min(nOps, 2000u) : nOps;
+    JournalOptions options{};
+    options.groupEntries = group;
+    auto t0 = Clock::now();
+    {
+      JournaledOrderCache joc{snapshotPath, journalPath, options};
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        joc.addOrder(Order("OrdId" + to_string(i), "SecId" + to_string(i % 1000), i % 2 ? "Buy" : "Sell", 100, "User" + to_string(i % 5000), "Company" + to_string(i % 100)));
+      }
+      joc.flush();
+    }
+    cout << "journaled addOrder, groups of " << setw(4) << group << ": " << setw(10) << static_cast<unsigned long long>(n / (elapsedMs(t0) / 1e3)) << " orders/s" << endl;
+  }
+  auto t0 = Clock::now();
+  OrderCache replayed;
+  auto tail = OrderJournal::replay(replayed, journalPath);
+  cout << "journal replay: " << tail.applied << " entries in " << elapsedMs(t0) << " ms" << endl;
+  std::remove(snapshotPath.c_str());
+  std::remove(journalPath.c_str());
+}
+
+/* Replay a workload file (OrderWorkloadGen, or a generated default when path is empty) into an
+empty cache, timing every operation into a histogram per kind. */
+void benchWorkload(string path, unsigned int nOps)
+{
+  bool generated = path.empty();
+  if (generated)
+  {
+    path = "OrderCacheBench.workload";
+    WorkloadOptions options{};
+    options.operations = nOps;
+    writeWorkload(options, path);
+  }
+  static const char* names[] = {"addOrder", "cancelOrder", "cancelOrdersForUser", "cancelOrdersForSecIdWithMinimumQty", "getMatchingSizeForSecurity"};
+  LatencyHistogram<> latencies[5]{};
+  OrderCache oc;
+  unsigned long long matched{0};
+  auto t0 = Clock::now();
+  auto tail = WorkloadFile::read(path, [&](const JournalCodec::Entry& e)
+  {
+    LatencyTimer<LatencyHistogram<>> timer{latencies[static_cast<int>(e.op) - 1]};
+    matched += WorkloadFile::apply(oc, e);
+  });
+  auto ms = elapsedMs(t0);
+  cout << "workload " << path << ": " << tail.applied << " operations in " << ms << " ms (" << static_cast<unsigned long long>(tail.applied / (ms / 1e3))
+       << " ops/s), " << oc.size() << " orders left, " << matched << " matched" << endl;
+  for (int op = 0; op < 5; ++op) cout << "  " << left << setw(35) << names[op] << right << ": " << LatencySummary::of(latencies[op]) << endl;
+  if (generated) std::remove(path.c_str());
+}
+
+long peakRssMb()
+{
+#ifdef ORDERCACHE_HAS_MMAP
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024;
+#else
+  return -1;
+#endif
+}
+
+//JSON file ingest: streaming SAX load against a DOM parse (the DOM only for files it can hold).
+void benchJsonLoad(unsigned int nOrders)
+{
+  std::string path{"OrderCacheBench.json"};
+  {
+    std::ofstream out{path};
+    std::mt19937 rng{7};
+    out << '[';
+    for (unsigned int i = 0; i < nOrders; ++i)
+    {
+      nlohmann::json j{{"orderid", "OrdId" + to_string(i)}, {"securityid", "SecId" + to_string(rng() % 20000)}, {"side", rng() % 2 ? "Buy" : "Sell"},
+        {"qty", 100 * (1 + rng() % 50)}, {"user", "User" + to_string(rng() % 10000)}, {"company", "Company" + to_string(rng() % 2000)}};
+      out << (i ? ",\n" : "\n") << j.dump();
+    }
+    out << "\n]\n";
+  }
+  auto mb = static_cast<double>(std::filesystem::file_size(path)) / (1 << 20);
+  auto rss0 = peakRssMb();
+
+  auto t0 = Clock::now();
+  {
+    OrderCache oc;
+    auto result = loadOrdersJson(oc, path);
+    auto ms = elapsedMs(t0);
+    cout << "JSON SAX load: " << mb << " MB, " << result.added << " orders in " << ms << " ms (" << mb / ms * 1e3 << " MB/s), peak RSS "
+      << rss0 << " -> " << peakRssMb() << " MB" << endl;
+  }
+  if (mb <= 256)
+  {
+    t0 = Clock::now();
+    OrderCache oc;
+    std::ifstream in{path};
+    auto dom = nlohmann::json::parse(in);
+    for (auto& j : dom) oc.addOrder(Order(j["orderid"], j["securityid"], j["side"], j["qty"], j["user"], j["company"]));
+    cout << "JSON DOM load: " << dom.size() << " orders in " << elapsedMs(t0) << " ms, peak RSS " << peakRssMb() << " MB" << endl;
+  }
+  std::remove(path.c_str());
+}
+
+//Shipping a book: one JSON object per order against the columnar CBOR/MessagePack encodings.
+void benchColumnar(const OrderCache& oc)
+{
+  auto report = [](const char* what, double encodeMs, size_t bytes, double decodeMs, size_t orders)
+  {
+    cout << what << ": encode " << setw(8) << encodeMs << " ms, " << setw(7) << bytes / double(1 << 20) << " MB, decode+load "
+      << setw(8) << decodeMs << " ms (" << orders << " orders)" << endl;
+  };
+
+  auto t0 = Clock::now();
+  auto rows = nlohmann::json::array();
+  oc.forEachOrder([&](const OrderView& o)
+  {
+    rows.push_back(nlohmann::json{{"orderid", o.orderId}, {"securityid", o.securityId}, {"side", o.side}, {"qty", o.qty}, {"user", o.user}, {"company", o.company}});
+  });
+  auto text = rows.dump();
+  auto encodeMs = elapsedMs(t0);
+  t0 = Clock::now();
+  {
+    OrderCache loaded;
+    std::istringstream in{text};
+    loadOrdersJson(loaded, in);
+    report("row JSON         ", encodeMs, text.size(), elapsedMs(t0), loaded.size());
+  }
+
+  for (auto msgpack : {false, true})
+  {
+    t0 = Clock::now();
+    auto bytes = msgpack ? OrderCacheColumnar::toMsgpack(oc) : OrderCacheColumnar::toCbor(oc);
+    encodeMs = elapsedMs(t0);
+    t0 = Clock::now();
+    OrderCache loaded;
+    msgpack ? OrderCacheColumnar::fromMsgpack(loaded, bytes) : OrderCacheColumnar::fromCbor(loaded, bytes);
+    report(msgpack ? "columnar MsgPack " : "columnar CBOR    ", encodeMs, bytes.size(), elapsedMs(t0), loaded.size());
+  }
+}
+
+//Full book read: a deep copy of every order against a visit of views, then one security.
+void benchOrderScan(const OrderCache& oc)
+{
+  unsigned long long totalQty{0};
+  auto t0 = Clock::now();
+  auto allOrders = oc.getAllOrders();
+  for (auto& o : allOrders) totalQty += o.qty();
+  cout << "getAllOrders()         : " << setw(8) << elapsedMs(t0) << " ms" << endl;
+
+  t0 = Clock::now();
+  oc.forEachOrder([&](const OrderView& o) { totalQty += o.qty; });
+  cout << "forEachOrder()         : " << setw(8) << elapsedMs(t0) << " ms" << endl;
+
+  //An empty book (a bench size of 0) has no security to view.
+  if (!allOrders.empty())
+  {
+    t0 = Clock::now();
+    size_t n{0};
+    for (auto o : oc.viewOrders(OrderFilter{allOrders.front().securityIdRef()})) totalQty += o.qty, ++n;
+    cout << "viewOrders(security)   : " << setw(8) << elapsedMs(t0) * 1e3 << " us for " << n << " orders" << endl;
+  }
+  cout << "(" << totalQty << " total qty)" << endl;
+}
+
+//Order id index: FlatIndex against the std::unordered_map it replaced, add/find/cancel.
+void benchOrderIdIndex(unsigned int nOrders)
+{
+  vector<string> orderIds{};
+  orderIds.reserve(nOrders);
+  for (unsigned int i = 0; i < nOrders; ++i) orderIds.push_back("OrdId" + to_string(i));
+  auto keyOf = [&](uint32_t i) -> const string& { return orderIds[i]; };
+
+  auto report = [&](const char* what, Clock::time_point t0)
+  {
+    cout << what << ": " << setw(8) << elapsedMs(t0) * 1e6 / nOrders << " ns/op" << endl;
+  };
+  size_t hits{0};
+
+  {
+    unordered_map<string, uint32_t> index{};
+    auto t0 = Clock::now();
+    for (uint32_t i = 0; i < nOrders; ++i) index.emplace(orderIds[i], i);
+    report("unordered_map add   ", t0);
+    t0 = Clock::now();
+    for (uint32_t i = 0; i < nOrders; ++i) hits += index.find(orderIds[(i * 7919ull) % nOrders]) != index.end();
+    report("unordered_map find  ", t0);
+    t0 = Clock::now();
+    for (uint32_t i = 0; i < nOrders; ++i) index.erase(orderIds[i]);
+    report("unordered_map cancel", t0);
+  }
+  {
+    FlatIndex index{};
+    auto t0 = Clock::now();
+    for (uint32_t i = 0; i < nOrders; ++i) index.insert(orderIds[i], i, keyOf);
+    report("FlatIndex add       ", t0);
+    t0 = Clock::now();
+    for (uint32_t i = 0; i < nOrders; ++i) hits += index.find(orderIds[(i * 7919ull) % nOrders], keyOf) != FlatIndex::nvalue;
+    report("FlatIndex find      ", t0);
+    t0 = Clock::now();
+    for (uint32_t i = 0; i < nOrders; ++i) index.erase(orderIds[i], keyOf);
+    report("FlatIndex cancel    ", t0);
+  }
+  cout << "(" << hits << " hits)" << endl;
+}
+
+//Purpose: the baseline for concurrent ingest, one OrderCache behind one mutex.
+class MutexOrderCache
+{
+  mutex m{};
+  OrderCache cache{};
+
+public:
+  void addOrder(Order o) { lock_guard<mutex> lock{m}; cache.addOrder(std::move(o)); }
+  void cancelOrder(const string& orderId) { lock_guard<mutex> lock{m}; cache.cancelOrder(orderId); }
+  unsigned int getMatchingSizeForSecurity(const string& securityId) { lock_guard<mutex> lock{m}; return cache.getMatchingSizeForSecurity(securityId); }
+};
+
+//Every thread adds its own orders, cancels one in four and polls a matching size one in sixteen.
+template <typename Cache>
+double ingestThroughput(Cache& cache, unsigned int threads, unsigned int nOps)
+{
+  vector<thread> workers{};
+  auto opsPerThread = nOps / threads;
+  auto t0 = Clock::now();
+  for (unsigned int t = 0; t < threads; ++t)
+  {
+    workers.emplace_back([&cache, t, opsPerThread]
+    {
+      std::mt19937 rng{t};
+      auto prefix = "T" + to_string(t) + "-";
+      for (unsigned int i = 0; i < opsPerThread; ++i)
+      {
+        auto secId = "SecId" + to_string(rng() % 5000);
+        cache.addOrder(Order(prefix + to_string(i), secId, i % 2 ? "Buy" : "Sell", 100, "User" + to_string(t), "Company" + to_string(rng() % 100)));
+        if (i % 4 == 3) cache.cancelOrder(prefix + to_string(i - 2));
+        if (i % 16 == 15) cache.getMatchingSizeForSecurity(secId);
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+  return opsPerThread * threads / (elapsedMs(t0) / 1000.0);
+}
+
+void benchShardedThroughput(unsigned int nOps)
+{
+  for (unsigned int threads = 1; threads <= 32; threads *= 2)
+  {
+    MutexOrderCache single{};
+    ShardedOrderCache sharded{64, 256};
+    auto singleOps = ingestThroughput(single, threads, nOps);
+    auto shardedOps = ingestThroughput(sharded, threads, nOps);
+    cout << "ingest " << setw(2) << threads << " threads: mutex OrderCache " << setw(10) << fixed << setprecision(0) << singleOps
+         << " adds/s, ShardedOrderCache " << setw(10) << shardedOps << " adds/s" << defaultfloat << setprecision(6) << endl;
+  }
+}
+
+//Bursts of orders: one addOrder() per order against addOrders() per burst, then the same for cancels.
+void benchBatchIngest(unsigned int nOrders, unsigned int burst)
+{
+  std::mt19937 rng{3};
+  vector<Order> os{};
+  vector<string> ids{};
+  os.reserve(nOrders);
+  for (unsigned int i = 0; i < nOrders; ++i)
+  {
+    os.emplace_back("OrdId" + to_string(i), "SecId" + to_string(rng() % 5000), rng() % 2 ? "Buy" : "Sell", 100, "User" + to_string(rng() % 1000), "Company" + to_string(rng() % 100));
+    ids.push_back(os.back().orderId());
+  }
+
+  auto rate = [&](Clock::time_point t0) { return nOrders / (elapsedMs(t0) / 1000.0); };
+  cout << fixed << setprecision(0);
+  {
+    OrderCache oc;
+    auto t0 = Clock::now();
+    for (auto& o : os) oc.addOrder(o);
+    cout << "addOrder    " << setw(10) << rate(t0) << " orders/s" << endl;
+    t0 = Clock::now();
+    for (auto& id : ids) oc.cancelOrder(id);
+    cout << "cancelOrder " << setw(10) << rate(t0) << " orders/s" << endl;
+  }
+  {
+    OrderCache oc;
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < os.size(); i += burst) oc.addOrders(os.begin() + i, os.begin() + min<size_t>(os.size(), i + burst));
+    cout << "addOrders   " << setw(10) << rate(t0) << " orders/s (bursts of " << burst << ")" << endl;
+    t0 = Clock::now();
+    for (size_t i = 0; i < ids.size(); i += burst) oc.cancelOrders(ids.begin() + i, ids.begin() + min<size_t>(ids.size(), i + burst));
+    cout << "cancelOrders" << setw(10) << rate(t0) << " orders/s (bursts of " << burst << ")" << endl;
+  }
+  cout << defaultfloat << setprecision(6);
+}
+
+void printLatencies(const char* what, vector<double>& ns)
+{
+  if (ns.empty())
+  {
+    cout << what << ": no samples" << endl;
+    return;
+  }
+  sort(ns.begin(), ns.end());
+  auto at = [&](double q) { return ns[min(ns.size() - 1, static_cast<size_t>(q * ns.size()))]; };
+  cout << fixed << setprecision(0) << what << ": p50 " << setw(7) << at(0.5) << " ns, p99 " << setw(7) << at(0.99)
+       << " ns, p99.9 " << setw(8) << at(0.999) << " ns, max " << setw(9) << ns.back() << " ns" << defaultfloat << setprecision(6) << endl;
+}
+
+//addOrder latency seen by producers: mutex-wrapped cache against the queued single writer cache.
+template <typename Cache, typename Add>
+vector<double> producerLatencies(Cache& cache, unsigned int producers, unsigned int nOps, const Add& add)
+{
+  vector<vector<double>> perThread(producers);
+  vector<thread> workers{};
+  for (unsigned int t = 0; t < producers; ++t)
+  {
+    workers.emplace_back([&, t]
+    {
+      auto prefix = "P" + to_string(t) + "-";
+      auto& ns = perThread[t];
+      ns.reserve(nOps / producers);
+      for (unsigned int i = 0; i < nOps / producers; ++i)
+      {
+        Order o(prefix + to_string(i), "SecId" + to_string(i % 1000), i % 2 ? "Buy" : "Sell", 100, "User" + to_string(t), "Company" + to_string(i % 50));
+        auto t0 = Clock::now();
+        add(cache, std::move(o));
+        ns.push_back(chrono::duration<double, nano>(Clock::now() - t0).count());
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+
+  vector<double> all{};
+  for (auto& ns : perThread) all.insert(all.end(), ns.begin(), ns.end());
+  return all;
+}
+
+void benchQueuedLatency(unsigned int nOps, unsigned int producers)
+{
+  {
+    MutexOrderCache cache{};
+    auto ns = producerLatencies(cache, producers, nOps, [](MutexOrderCache& c, Order o) { c.addOrder(std::move(o)); });
+    printLatencies("mutex OrderCache addOrder        ", ns);
+  }
+  {
+    QueuedOrderCache cache{};
+    auto ns = producerLatencies(cache, producers, nOps, [](QueuedOrderCache& c, Order o) { c.addOrder(std::move(o)); });
+    printLatencies("QueuedOrderCache addOrder        ", ns);
+  }
+  {
+    QueuedOrderCache cache{};
+    auto ns = producerLatencies(cache, producers, nOps / 10, [](QueuedOrderCache& c, Order o) { c.addOrderAsync(std::move(o)).get(); });
+    printLatencies("QueuedOrderCache addOrderAsync+get", ns);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  unsigned int nOrders = argc > 1 ? stoul(argv[1]) : 1000000;
+  unsigned int maxThreads = argc > 2 ? stoul(argv[2]) : max(1u, thread::hardware_concurrency());
+  unsigned int nIndexOrders = argc > 3 ? stoul(argv[3]) : 10000000;
+  unsigned int nJsonOrders = argc > 4 ? stoul(argv[4]) : 1000000;
+  string workloadPath = argc > 5 ? argv[5] : "";
+
+  OrderCache oc;
+  auto t0 = Clock::now();
+  fillBook(oc, nOrders, 20000, 2000);
+  cout << "book: " << nOrders << " orders, " << oc.getSecs().size() << " securities, built in " << elapsedMs(t0) << " ms" << endl;
+  cout << "book memory:" << endl << oc.memoryUsage();
+
+  benchParallelMatching(oc, maxThreads, 10);
+  benchOrderScan(oc);
+  benchSnapshotRestart(oc);
+  benchJournal(min(nOrders, 200000u));
+  benchJsonLoad(nJsonOrders);
+  benchColumnar(oc);
+  benchWorkload(workloadPath, nOrders);
+  if (OrderCacheStats::enabled) cout << "book latencies:" << endl << oc.stats();
+  benchOrderIdIndex(nIndexOrders);
+  benchBatchIngest(nOrders, 4096);
+  benchShardedThroughput(nOrders);
+  benchQueuedLatency(nOrders, 4);
+  return 0;
+}
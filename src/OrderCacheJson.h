@@ -0,0 +1,279 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include "OrderCache.h"
+#include "json.hpp"
+
+//Outcome of a JSON load: orders added, order objects turned down (missing field, bad qty, duplicate id).
+struct JsonLoadResult
+{
+  bool ok{false};
+  size_t added{0};
+  size_t rejected{0};
+  string error{};
+};
+
+/* SAX handler streaming a JSON array of {orderid, securityid, side, qty, user, company} objects
+(the createJsonOrder() shape) into an OrderCache. No DOM is built: the fields of the order being
+parsed go to six reused buffers and the order is emplaced as soon as its object closes, so the
+parser holds one order at a time whatever the file size. Unknown keys and their values (however
+nested) are skipped. */
+class OrderJsonSax
+{
+  enum Field { OrderId, SecurityId, SideField, User, Company, Qty, Other };
+  static constexpr unsigned allFields = (1u << Qty) | (1u << OrderId) | (1u << SecurityId) | (1u << SideField) | (1u << User) | (1u << Company);
+
+  OrderCache& cache;
+  std::string fields[Qty]{};
+  unsigned int qty{0};
+  unsigned present{0};
+  bool qtyOk{true};
+  Field field{Other};
+  //1 inside the top level array, 2 inside an order object, deeper inside a skipped value.
+  size_t depth{0};
+
+  bool value(Field f)
+  {
+    //Only a plain value right under an order object counts.
+    if (depth == 2 && field == f) present |= 1u << f;
+    return true;
+  }
+
+public:
+  using number_integer_t = nlohmann::json::number_integer_t;
+  using number_unsigned_t = nlohmann::json::number_unsigned_t;
+  using number_float_t = nlohmann::json::number_float_t;
+  using string_t = nlohmann::json::string_t;
+  using binary_t = nlohmann::json::binary_t;
+
+  JsonLoadResult result{};
+
+  explicit OrderJsonSax(OrderCache& oc) : cache(oc) {}
+
+  bool null() { return true; }
+  bool boolean(bool) { return true; }
+  bool number_integer(number_integer_t v)
+  {
+    if (depth == 2 && field == Qty)
+    {
+      qtyOk = v >= 0 && static_cast<unsigned long long>(v) <= ~0u;
+      qty = static_cast<unsigned int>(v);
+    }
+    return value(Qty);
+  }
+  bool number_unsigned(number_unsigned_t v)
+  {
+    if (depth == 2 && field == Qty)
+    {
+      qtyOk = v <= ~0u;
+      qty = static_cast<unsigned int>(v);
+    }
+    return value(Qty);
+  }
+  bool number_float(number_float_t, const string_t&)
+  {
+    if (depth == 2 && field == Qty) qtyOk = false;
+    return value(Qty);
+  }
+  bool string(string_t& v)
+  {
+    if (depth == 2 && field < Qty) fields[field].swap(v);
+    return field < Qty ? value(field) : true;
+  }
+  bool binary(binary_t&) { return true; }
+
+  bool start_object(size_t)
+  {
+    //The top level must be an array of orders.
+    if (depth == 0)
+    {
+      result.error = "expected an array of orders";
+      return false;
+    }
+    if (++depth == 2)
+    {
+      present = 0;
+      qtyOk = true;
+    }
+    field = Other;
+    return true;
+  }
+  bool key(string_t& k)
+  {
+    if (depth != 2) return true;
+    if (k == "orderid") field = OrderId;
+    else if (k == "securityid") field = SecurityId;
+    else if (k == "side") field = SideField;
+    else if (k == "qty") field = Qty;
+    else if (k == "user") field = User;
+    else if (k == "company") field = Company;
+    else field = Other;
+    return true;
+  }
+  bool end_object()
+  {
+    if (depth-- != 2) return true;
+    field = Other;
+    if (present != allFields || !qtyOk)
+    {
+      ++result.rejected;
+      return true;
+    }
+    auto before = cache.size();
+    cache.emplaceOrder(fields[OrderId], fields[SecurityId], fields[SideField], qty, fields[User], fields[Company]);
+    if (cache.size() != before) ++result.added;
+    else ++result.rejected;
+    return true;
+  }
+  bool start_array(size_t)
+  {
+    ++depth;
+    field = Other;
+    return true;
+  }
+  bool end_array()
+  {
+    --depth;
+    return true;
+  }
+  bool parse_error(size_t position, const std::string&, const nlohmann::detail::exception& e)
+  {
+    result.error = "byte " + to_string(position) + ": " + e.what();
+    return false;
+  }
+};
+
+//Purpose: stream JSON orders into oc as they are read. Orders already in the cache are kept, a duplicate id is rejected like in addOrder().
+inline JsonLoadResult loadOrdersJson(OrderCache& oc, istream& in)
+{
+  OrderJsonSax sax{oc};
+  sax.result.ok = nlohmann::json::sax_parse(in, &sax);
+  return sax.result;
+}
+/* Purpose: same as above from a file. It is read through a fixed buffer rather than mapped:
+as fast here, and the memory used stays the buffer plus the cache whatever the file size. */
+inline JsonLoadResult loadOrdersJson(OrderCache& oc, const string& path)
+{
+  vector<char> buffer(1 << 20);
+  ifstream in{};
+  in.rdbuf()->pubsetbuf(buffer.data(), static_cast<streamsize>(buffer.size()));
+  in.open(path, ios::binary);
+  if (!in)
+  {
+    JsonLoadResult result{};
+    result.error = "cannot open " + path;
+    return result;
+  }
+  return loadOrdersJson(oc, in);
+}
+
+/* Columnar export/import of a book, for shipping it between processes as CBOR or MessagePack.
+One array per field instead of one object per order: the names are dictionary encoded (the
+cache's own symbol tables, rows hold their index), sides are 0 (Buy) / 1 (Sell), so a row costs
+its order id plus a few small integers. Rows follow the arena order.
+  {"version": 1, "securities": [...], "users": [...], "companies": [...],
+   "orderid": [...], "securityid": [...], "user": [...], "company": [...], "side": [...], "qty": [...]} */
+class OrderCacheColumnar
+{
+  static nlohmann::json names(const SymbolTable& table)
+  {
+    auto j = nlohmann::json::array();
+    for (Symbol id = 0; id < table.size(); ++id) j.push_back(table.name(id));
+    return j;
+  }
+  static bool column(const nlohmann::json& j, const char* name, size_t rows, const nlohmann::json*& out)
+  {
+    auto it = j.find(name);
+    if (it == j.end() || !it->is_array() || it->size() != rows) return false;
+    out = &*it;
+    return true;
+  }
+  static bool index(const nlohmann::json& v, size_t size, size_t& out)
+  {
+    if (!v.is_number_unsigned()) return false;
+    out = v.get<size_t>();
+    return out < size;
+  }
+
+public:
+  static nlohmann::json toJson(const OrderCache& oc)
+  {
+    auto orderIds = nlohmann::json::array(), securityIds = nlohmann::json::array(), users = nlohmann::json::array();
+    auto companies = nlohmann::json::array(), sides = nlohmann::json::array(), qtys = nlohmann::json::array();
+    for (auto* c : {&orderIds, &securityIds, &users, &companies, &sides, &qtys}) c->get_ref<nlohmann::json::array_t&>().reserve(oc.size());
+    for (OrderHandle h = 0; h < oc.orders.end(); ++h)
+    {
+      auto& e = oc.orders[h];
+      if (!e.live) continue;
+      orderIds.push_back(std::string{e.orderId});
+      securityIds.push_back(e.record.securityId);
+      users.push_back(e.record.user);
+      companies.push_back(e.record.company);
+      sides.push_back(static_cast<unsigned>(e.record.side));
+      qtys.push_back(e.record.qty);
+    }
+    return nlohmann::json{{"version", 1}, {"securities", names(oc.securities)}, {"users", names(oc.users)}, {"companies", names(oc.companies)},
+      {"orderid", std::move(orderIds)}, {"securityid", std::move(securityIds)}, {"user", std::move(users)}, {"company", std::move(companies)},
+      {"side", std::move(sides)}, {"qty", std::move(qtys)}};
+  }
+  static vector<uint8_t> toCbor(const OrderCache& oc) { return nlohmann::json::to_cbor(toJson(oc)); }
+  static vector<uint8_t> toMsgpack(const OrderCache& oc) { return nlohmann::json::to_msgpack(toJson(oc)); }
+
+  /* Purpose: add the orders of a columnar book to oc (duplicate ids are skipped like in addOrder()).
+  False, with nothing added, when the document is not a well formed columnar book. */
+  static bool fromJson(OrderCache& oc, const nlohmann::json& j)
+  {
+    if (!j.is_object()) return false;
+    auto version = j.find("version");
+    if (version == j.end() || !version->is_number_integer() || version->get<int64_t>() != 1) return false;
+    const nlohmann::json *securities{}, *users{}, *companies{};
+    for (auto table : {make_pair("securities", &securities), make_pair("users", &users), make_pair("companies", &companies)})
+    {
+      auto it = j.find(table.first);
+      if (it == j.end() || !it->is_array()) return false;
+      for (auto& name : *it) if (!name.is_string()) return false;
+      *table.second = &*it;
+    }
+
+    auto orderIds = j.find("orderid");
+    if (orderIds == j.end() || !orderIds->is_array()) return false;
+    auto rows = orderIds->size();
+    const nlohmann::json *securityIds{}, *userIds{}, *companyIds{}, *sides{}, *qtys{};
+    if (!column(j, "securityid", rows, securityIds) || !column(j, "user", rows, userIds) || !column(j, "company", rows, companyIds)
+      || !column(j, "side", rows, sides) || !column(j, "qty", rows, qtys))
+    {
+      return false;
+    }
+    //Every row is checked before the first one goes in.
+    size_t i{};
+    for (size_t row = 0; row < rows; ++row)
+    {
+      auto& qty = (*qtys)[row];
+      if (!(*orderIds)[row].is_string() || !index((*securityIds)[row], securities->size(), i) || !index((*userIds)[row], users->size(), i)
+        || !index((*companyIds)[row], companies->size(), i) || !index((*sides)[row], 2, i)
+        || !qty.is_number_unsigned() || qty.get<unsigned long long>() > ~0u)
+      {
+        return false;
+      }
+    }
+
+    oc.orders.reserve(rows);
+    oc.order_index.reserve(oc.order_index.size() + rows);
+    auto name = [](const nlohmann::json& table, const nlohmann::json& id) -> const std::string& { return table[id.get<size_t>()].get_ref<const std::string&>(); };
+    for (size_t row = 0; row < rows; ++row)
+    {
+      oc.emplaceOrder((*orderIds)[row].get_ref<const std::string&>(), name(*securities, (*securityIds)[row]), (*sides)[row].get<unsigned>() == 0 ? "Buy" : "Sell",
+        (*qtys)[row].get<unsigned int>(), name(*users, (*userIds)[row]), name(*companies, (*companyIds)[row]));
+    }
+    return true;
+  }
+  static bool fromCbor(OrderCache& oc, const vector<uint8_t>& bytes)
+  {
+    return fromJson(oc, nlohmann::json::from_cbor(bytes, true, false));
+  }
+  static bool fromMsgpack(OrderCache& oc, const vector<uint8_t>& bytes)
+  {
+    return fromJson(oc, nlohmann::json::from_msgpack(bytes, true, false));
+  }
+};
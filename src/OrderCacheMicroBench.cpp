@@ -0,0 +1,197 @@
+#include "OrderCache.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+
+/* Microbenchmarks of the six OrderCacheInterface methods on books of 1K to 10M orders, reporting
+ns/op, ops/s and heap allocations per op. The methods are called through OrderCacheInterface&,
+as a client would. Allocations are counted by replacing the global operator new, which is why
+this is its own executable: the counter would tax every other benchmark. */
+
+namespace
+{
+  std::atomic<unsigned long long> allocations{0};
+
+  void* countedAlloc(size_t n, size_t alignment)
+  {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (n == 0) n = 1;
+    void* p = alignment <= alignof(std::max_align_t) ? std::malloc(n) : std::aligned_alloc(alignment, (n + alignment - 1) / alignment * alignment);
+    if (!p) throw std::bad_alloc{};
+    return p;
+  }
+}
+
+void* operator new(size_t n) { return countedAlloc(n, 0); }
+void* operator new[](size_t n) { return countedAlloc(n, 0); }
+void* operator new(size_t n, std::align_val_t a) { return countedAlloc(n, static_cast<size_t>(a)); }
+void* operator new[](size_t n, std::align_val_t a) { return countedAlloc(n, static_cast<size_t>(a)); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+using Clock = chrono::steady_clock;
+
+//Sums the time and allocations of the sections between start() and stop(), the set up around them is left out.
+class Meter
+{
+  Clock::time_point t0{};
+  unsigned long long allocations0{0};
+
+public:
+  double ns{0};
+  unsigned long long allocs{0};
+  unsigned long long ops{0};
+  unsigned long long orders{0};
+
+  void start()
+  {
+    allocations0 = allocations.load(std::memory_order_relaxed);
+    t0 = Clock::now();
+  }
+  //Purpose: close a section of n calls touching (adding, removing, returning) touched orders.
+  void stop(unsigned long long n, unsigned long long touched)
+  {
+    ns += chrono::duration<double, nano>(Clock::now() - t0).count();
+    allocs += allocations.load(std::memory_order_relaxed) - allocations0;
+    ops += n;
+    orders += touched;
+  }
+};
+
+void report(const char* method, const Meter& m)
+{
+  auto perOp = [&](double v) { return m.ops ? v / static_cast<double>(m.ops) : 0.0; };
+  cout << "  " << left << setw(36) << method << right << setw(10) << m.ops << setw(15) << fixed << setprecision(1) << perOp(m.ns)
+       << setw(14) << (m.ns > 0 ? 1e9 * static_cast<double>(m.ops) / m.ns : 0.0)
+       << setw(11) << setprecision(2) << perOp(static_cast<double>(m.allocs)) << setw(11) << setprecision(1) << perOp(static_cast<double>(m.orders))
+       << defaultfloat << endl;
+}
+
+/* Shape of a book of n orders: a few hot securities take 10% of the orders, the rest spread
+over a long tail; every user trades for one company. Order i is the same for a given n. */
+struct BookShape
+{
+  unsigned int orders;
+  unsigned int securities;
+  unsigned int users;
+  unsigned int companies;
+
+  explicit BookShape(unsigned int n)
+    : orders(n), securities(max(8u, n / 100)), users(max(4u, n / 50)), companies(max(2u, n / 2000)) {}
+
+  static string orderId(unsigned int i) { return "OrdId" + to_string(i); }
+  static string securityId(unsigned int s) { return "SecId" + to_string(s); }
+  static string user(unsigned int u) { return "User" + to_string(u); }
+  Order order(unsigned int i, std::mt19937& rng) const
+  {
+    auto sec = i % 10 == 0 ? rng() % 8 : rng() % securities;
+    auto u = rng() % users;
+    return Order(orderId(i), securityId(sec), rng() % 2 ? "Buy" : "Sell", 100 * (1 + rng() % 50), user(u), "Company" + to_string(u % companies));
+  }
+};
+
+constexpr unsigned int chunk = 1 << 16;
+
+/* One pass over a book of n orders: fill it, read it, then empty it with each kind of cancel.
+The cancels each take a share: cancelOrder half of the orders (in a scattered order), the
+security cancels the orders of 2500 or more left of every security, the user cancels the rest. */
+void benchBook(unsigned int n)
+{
+  BookShape shape{n};
+  cout << "book of " << n << " orders, " << shape.securities << " securities, " << shape.users << " users, " << shape.companies << " companies" << endl;
+  cout << "  " << left << setw(36) << "method" << right << setw(10) << "ops" << setw(15) << "ns/op" << setw(14) << "ops/s"
+       << setw(11) << "allocs/op" << setw(11) << "orders/op" << endl;
+
+  OrderCache cache;
+  OrderCacheInterface& oc = cache;
+  std::mt19937 rng{42};
+
+  Meter add{};
+  vector<Order> orders{};
+  orders.reserve(chunk);
+  for (unsigned int i = 0; i < n;)
+  {
+    orders.clear();
+    for (; i < n && orders.size() < chunk; ++i) orders.push_back(shape.order(i, rng));
+    add.start();
+    for (auto& o : orders) oc.addOrder(std::move(o));
+    add.stop(orders.size(), orders.size());
+  }
+  report("addOrder", add);
+  orders = vector<Order>{};
+
+  vector<string> securities{};
+  for (unsigned int s = 0; s < shape.securities; ++s) securities.push_back(BookShape::securityId(s));
+  Meter match{};
+  unsigned long long matched{0};
+  auto rounds = max(1u, 100000u / shape.securities);
+  match.start();
+  for (unsigned int r = 0; r < rounds; ++r)
+  {
+    for (auto& secId : securities) matched += oc.getMatchingSizeForSecurity(secId);
+  }
+  match.stop(static_cast<unsigned long long>(rounds) * securities.size(), 0);
+  report("getMatchingSizeForSecurity", match);
+
+  //Freeing the returned orders is part of the cost of a call.
+  Meter all{};
+  for (unsigned int r = 0, reps = max(1u, 1000000u / n); r < reps; ++r)
+  {
+    all.start();
+    auto returned = oc.getAllOrders().size();
+    all.stop(1, returned);
+  }
+  report("getAllOrders", all);
+
+  //k * 2654435761 mod n walks 0..n-1 in a scattered order (the multiplier is prime to 2 and 5).
+  Meter cancel{};
+  vector<string> ids{};
+  ids.reserve(chunk);
+  for (unsigned int k = 0; k < n / 2;)
+  {
+    ids.clear();
+    for (; k < n / 2 && ids.size() < chunk; ++k) ids.push_back(BookShape::orderId(static_cast<unsigned int>(k * 2654435761ull % n)));
+    cancel.start();
+    for (auto& id : ids) oc.cancelOrder(id);
+    cancel.stop(ids.size(), ids.size());
+  }
+  report("cancelOrder", cancel);
+
+  Meter secCancel{};
+  auto before = cache.size();
+  secCancel.start();
+  for (auto& secId : securities) oc.cancelOrdersForSecIdWithMinimumQty(secId, 2500);
+  secCancel.stop(securities.size(), before - cache.size());
+  report("cancelOrdersForSecIdWithMinimumQty", secCancel);
+
+  vector<string> users{};
+  for (unsigned int u = 0; u < shape.users; ++u) users.push_back(BookShape::user(u));
+  Meter userCancel{};
+  before = cache.size();
+  userCancel.start();
+  for (auto& user : users) oc.cancelOrdersForUser(user);
+  userCancel.stop(users.size(), before - cache.size());
+  report("cancelOrdersForUser", userCancel);
+
+  if (cache.size() != 0 || matched == 0) cout << "  unexpected: " << cache.size() << " orders left, matched " << matched << endl;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned int maxOrders = argc > 1 ? stoul(argv[1]) : 10000000;
+  for (unsigned int n = 1000; n <= maxOrders; n *= 10)
+  {
+    benchBook(n);
+    if (n > ~0u / 10) break;
+  }
+  return 0;
+}
@@ -0,0 +1,391 @@
+#pragma once
+#include <cstring>
+#include <cstdio>
+#include "OrderCache.h"
+#include "MappedFile.h"
+
+/* Binary snapshot of an OrderCache, for a fast restart.
+The file holds the interned name tables, the live orders packed and renumbered 0..n-1, the
+per user/security lists, the totals, the qty indexes (already sorted) and the order id index
+table as is. Loading maps the file and copies each section in place: no order goes through
+addOrder(), no order id is hashed and no list is rebuilt. Only the names are interned again
+(there are few) and each order id is copied into its arena slot.
+The layout is the native one (endianness, hash function): the header carries a hash check and
+a snapshot taken by an incompatible build is rejected, the caller then falls back to a replay.
+The header also carries a checksum of the rest of the file: the sections are only bounds
+checked on load, a flipped bit could otherwise make a list loop. */
+class OrderCacheSnapshot
+{
+  static constexpr char magic[8] = {'O', 'C', 'S', 'N', 'A', 'P', 0, 1};
+  static constexpr uint32_t version = 3;
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t hashCheck;
+    uint64_t orders;
+    uint64_t securities;
+    uint64_t users;
+    uint64_t companies;
+    uint64_t orderIdBytes;
+    uint64_t indexCapacity;
+    uint64_t sequence;
+    uint64_t checksum;
+  };
+  //One order, its links renumbered along with it. Explicit fields only: no padding goes to the file.
+  struct PackedOrder
+  {
+    uint32_t securityId;
+    uint32_t user;
+    uint32_t company;
+    uint32_t qty;
+    uint32_t side;
+    uint32_t orderIdOffset;
+    uint32_t orderIdLength;
+    uint32_t userPrev;
+    uint32_t userNext;
+    uint32_t secPrev;
+    uint32_t secNext;
+  };
+  struct PackedCompany
+  {
+    uint64_t company;
+    uint64_t buy;
+    uint64_t sell;
+  };
+  static_assert(sizeof(OrderList) == 8 && sizeof(QtyEntry) == 12 && sizeof(FlatIndex::Slot) == 8, "snapshot sections are written as is");
+
+  //Changes with the hash function, so a table written by another build is never taken as is.
+  static uint32_t hashCheck() { return FlatIndex::hashOf("OrderCacheSnapshot") ^ static_cast<uint32_t>(sizeof(size_t)); }
+
+  //FNV-1a over 8 byte words (fed in pieces of any size): each step is a bijection, so any flipped bit changes the sum.
+  class Checksum
+  {
+    uint64_t h{14695981039346656037ull};
+    char tail[8]{};
+    size_t tailBytes{0};
+
+    void word(const char* p)
+    {
+      uint64_t w{};
+      memcpy(&w, p, sizeof(w));
+      h = (h ^ w) * 1099511628211ull;
+    }
+
+  public:
+    void add(const char* p, size_t n)
+    {
+      for (; n && tailBytes; --n)
+      {
+        tail[tailBytes++] = *p++;
+        if (tailBytes == sizeof(tail))
+        {
+          word(tail);
+          tailBytes = 0;
+        }
+      }
+      for (; n >= sizeof(tail); p += sizeof(tail), n -= sizeof(tail)) word(p);
+      if (n) memcpy(tail, p, tailBytes = n);
+    }
+    uint64_t value() const
+    {
+      char last[8]{};
+      memcpy(last, tail, tailBytes);
+      uint64_t w{};
+      memcpy(&w, last, sizeof(w));
+      return (h ^ w ^ (uint64_t{tailBytes} << 56)) * 1099511628211ull;
+    }
+  };
+  //The output file and the checksum of what went to it.
+  struct Out
+  {
+    FILE* file;
+    Checksum sum{};
+    bool failed{false};
+
+    void bytes(const char* p, size_t n)
+    {
+      failed = failed || (n && fwrite(p, 1, n, file) != n);
+      sum.add(p, n);
+    }
+  };
+
+  template <typename T>
+  static void write(Out& out, const T& v) { out.bytes(reinterpret_cast<const char*>(&v), sizeof(T)); }
+  template <typename T>
+  static void write(Out& out, const T* first, size_t n) { out.bytes(reinterpret_cast<const char*>(first), n * sizeof(T)); }
+  //Purpose: memcpy that takes an empty section (whose destination may be null).
+  static void copyBytes(void* to, const void* from, size_t n)
+  {
+    if (n) memcpy(to, from, n);
+  }
+
+  static void writeNames(Out& out, const SymbolTable& table)
+  {
+    for (Symbol id = 0; id < table.size(); ++id)
+    {
+      auto name = table.name(id);
+      write(out, static_cast<uint32_t>(name.size()));
+      write(out, name.data(), name.size());
+    }
+  }
+  //Purpose: intern n names in file order, so they get back their ids. False on a short file or a duplicate name.
+  static bool readNames(ByteReader& in, uint64_t n, SymbolTable& table)
+  {
+    for (uint64_t i = 0; i < n; ++i)
+    {
+      uint32_t length{};
+      if (!in.read(length)) return false;
+      auto at = in.take<char>(length);
+      if (!at || table.intern(string_view{at, length}) != i) return false;
+    }
+    return true;
+  }
+  static bool validLists(const char* at, uint64_t n, uint64_t nOrders)
+  {
+    for (uint64_t i = 0; i < n; ++i)
+    {
+      OrderList list{};
+      memcpy(&list, at + i * sizeof(OrderList), sizeof(OrderList));
+      if (list.head != noOrder && list.head >= nOrders) return false;
+    }
+    return true;
+  }
+  static bool validLink(uint32_t h, uint64_t nOrders) { return h == noOrder || h < nOrders; }
+
+public:
+  /* Purpose: write the cache to path durably: a temporary file is fsynced, renamed over path and
+  the directory fsynced, so true means the snapshot survives a power loss. False on an I/O error,
+  path then still holds the previous snapshot. sequence is the caller's position the snapshot
+  was taken at (e.g. the last journal entry applied). */
+  static bool save(const OrderCache& oc, const string& path, uint64_t sequence = 0)
+  {
+    auto& orders = oc.orders;
+
+    //Live orders get the handles 0..n-1, in arena order.
+    vector<OrderHandle> renumbered(orders.end(), noOrder);
+    uint64_t nOrders{0}, idBytes{0};
+    for (OrderHandle h = 0; h < orders.end(); ++h)
+    {
+      if (!orders[h].live) continue;
+      renumbered[h] = static_cast<OrderHandle>(nOrders++);
+      idBytes += orders[h].orderId.size();
+    }
+    if (idBytes > ~uint32_t{0}) return false;
+    auto renumber = [&](OrderHandle h) { return h == noOrder ? noOrder : renumbered[h]; };
+
+    auto tmpPath = path + ".tmp";
+    Out out{fopen(tmpPath.c_str(), "wb")};
+    if (!out.file) return false;
+
+    auto& index = oc.order_index;
+    Header header{};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.hashCheck = hashCheck();
+    header.orders = nOrders;
+    header.securities = oc.securities.size();
+    header.users = oc.users.size();
+    header.companies = oc.companies.size();
+    header.orderIdBytes = idBytes;
+    header.indexCapacity = index.capacity();
+    header.sequence = sequence;
+    //Written again at the end, with the checksum of everything after it.
+    out.failed = fwrite(&header, sizeof(header), 1, out.file) != 1;
+
+    writeNames(out, oc.securities);
+    writeNames(out, oc.users);
+    writeNames(out, oc.companies);
+
+    vector<PackedOrder> packed{};
+    packed.reserve(nOrders);
+    uint32_t idOffset{0};
+    for (OrderHandle h = 0; h < orders.end(); ++h)
+    {
+      auto& e = orders[h];
+      if (!e.live) continue;
+      auto& r = e.record;
+      auto idLength = static_cast<uint32_t>(e.orderId.size());
+      packed.push_back(PackedOrder{r.securityId, r.user, r.company, r.qty, static_cast<uint32_t>(r.side), idOffset, idLength,
+        renumber(e.userLinks.prev), renumber(e.userLinks.next), renumber(e.secLinks.prev), renumber(e.secLinks.next)});
+      idOffset += idLength;
+    }
+    write(out, packed.data(), packed.size());
+    for (OrderHandle h = 0; h < orders.end(); ++h)
+    {
+      if (orders[h].live) write(out, orders[h].orderId.data(), orders[h].orderId.size());
+    }
+
+    for (auto* lists : {&oc.user_ordersid, &oc.sec_ordersid})
+    {
+      for (auto list : *lists)
+      {
+        list.head = renumber(list.head);
+        write(out, list);
+      }
+    }
+
+    for (auto& secTotals : oc.sec_totals)
+    {
+      write(out, static_cast<uint64_t>(secTotals.buy));
+      write(out, static_cast<uint64_t>(secTotals.sell));
+      write(out, static_cast<uint64_t>(secTotals.companies.size()));
+      for (auto& kv : secTotals.companies) write(out, PackedCompany{kv.first, kv.second.buy, kv.second.sell});
+    }
+
+    //Stale qty entries are left behind, live ones all get generation 1 (and so do the orders on load).
+    vector<QtyEntry> entries{};
+    for (auto& qtyIndex : oc.sec_qtyindex)
+    {
+      qtyIndex.liveEntries(oc.isLive(), entries);
+      for (auto& q : entries) q = QtyEntry{q.qty, renumbered[q.h], 1};
+      write(out, static_cast<uint64_t>(entries.size()));
+      write(out, entries.data(), entries.size());
+    }
+
+    vector<FlatIndex::Slot> slots(index.slotTable().begin(), index.slotTable().end());
+    auto& dist = index.distTable();
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+      if (dist[i]) slots[i].value = renumbered[slots[i].value];
+    }
+    write(out, dist.data(), dist.size());
+    write(out, slots.data(), slots.size());
+
+    header.checksum = out.sum.value();
+    bool ok = !out.failed && fseek(out.file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out.file) == 1;
+    //The data reaches the disk before the rename points path at it.
+    ok = ok && fflush(out.file) == 0 && syncFile(out.file);
+    ok = fclose(out.file) == 0 && ok;
+    ok = ok && std::rename(tmpPath.c_str(), path.c_str()) == 0 && syncDirectoryOf(path);
+    if (!ok) std::remove(tmpPath.c_str());
+    return ok;
+  }
+
+  /* Purpose: load a snapshot into an empty cache. False (and the cache untouched) when the file
+  is missing, truncated, inconsistent or written by an incompatible build. */
+  static bool load(OrderCache& oc, const string& path, uint64_t* sequence = nullptr)
+  {
+    if (oc.orders.end() != 0 || oc.securities.size() != 0 || oc.users.size() != 0 || oc.companies.size() != 0) return false;
+
+    MappedFile file{path};
+    if (!file.ok()) return false;
+    ByteReader in{file.data(), file.data() + file.size()};
+
+    Header header{};
+    if (!in.read(header) || memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.hashCheck != hashCheck()) return false;
+    auto nOrders = header.orders;
+    auto capacity = header.indexCapacity;
+    if (nOrders >= noOrder || (capacity & (capacity - 1)) != 0 || capacity * 4 < nOrders * 5) return false;
+    Checksum sum{};
+    sum.add(in.p, static_cast<size_t>(in.end - in.p));
+    if (sum.value() != header.checksum) return false;
+
+    //First pass: locate every section and check it, nothing in the cache changes until the file is known good.
+    SymbolTable securities{}, users{}, companies{};
+    if (!readNames(in, header.securities, securities) || !readNames(in, header.users, users) || !readNames(in, header.companies, companies)) return false;
+
+    auto packed = in.take<PackedOrder>(nOrders);
+    auto orderIds = in.take<char>(header.orderIdBytes);
+    auto userLists = in.take<OrderList>(header.users);
+    auto secLists = in.take<OrderList>(header.securities);
+    if (!packed || !orderIds || !userLists || !secLists) return false;
+    for (uint64_t i = 0; i < nOrders; ++i)
+    {
+      PackedOrder p{};
+      memcpy(&p, packed + i * sizeof(PackedOrder), sizeof(PackedOrder));
+      if (p.securityId >= header.securities || p.user >= header.users || p.company >= header.companies || p.side > 1
+        || uint64_t{p.orderIdOffset} + p.orderIdLength > header.orderIdBytes
+        || !validLink(p.userPrev, nOrders) || !validLink(p.userNext, nOrders) || !validLink(p.secPrev, nOrders) || !validLink(p.secNext, nOrders))
+      {
+        return false;
+      }
+    }
+    if (!validLists(userLists, header.users, nOrders) || !validLists(secLists, header.securities, nOrders)) return false;
+
+    SecuritiesTotals totals(header.securities, oc.sec_totals.get_allocator());
+    for (auto& secTotals : totals)
+    {
+      uint64_t nCompanies{};
+      if (!in.read(secTotals.buy) || !in.read(secTotals.sell) || !in.read(nCompanies)) return false;
+      auto companies = in.take<PackedCompany>(nCompanies);
+      if (!companies) return false;
+      secTotals.companies.reserve(nCompanies);
+      for (uint64_t i = 0; i < nCompanies; ++i)
+      {
+        PackedCompany c{};
+        memcpy(&c, companies + i * sizeof(PackedCompany), sizeof(PackedCompany));
+        if (c.company >= header.companies) return false;
+        secTotals.companies.emplace(static_cast<Symbol>(c.company), CompanyTotals{c.buy, c.sell});
+      }
+    }
+
+    vector<pair<const char*, uint64_t>> qtyIndexes(header.securities);
+    for (auto& qtyIndex : qtyIndexes)
+    {
+      if (!in.read(qtyIndex.second)) return false;
+      qtyIndex.first = in.take<QtyEntry>(qtyIndex.second);
+      if (!qtyIndex.first) return false;
+      for (uint64_t i = 0; i < qtyIndex.second; ++i)
+      {
+        QtyEntry q{};
+        memcpy(&q, qtyIndex.first + i * sizeof(QtyEntry), sizeof(QtyEntry));
+        if (q.h >= nOrders) return false;
+      }
+    }
+
+    auto dist = in.take<uint8_t>(capacity);
+    auto slots = in.take<FlatIndex::Slot>(capacity);
+    if (!dist || !slots) return false;
+    uint64_t indexed{0};
+    for (uint64_t i = 0; i < capacity; ++i)
+    {
+      if (!dist[i]) continue;
+      FlatIndex::Slot slot{};
+      memcpy(&slot, slots + i * sizeof(FlatIndex::Slot), sizeof(FlatIndex::Slot));
+      if (slot.value >= nOrders) return false;
+      ++indexed;
+    }
+    if (indexed != nOrders) return false;
+
+    //Second pass: fill the cache.
+    oc.securities = std::move(securities);
+    oc.users = std::move(users);
+    oc.companies = std::move(companies);
+
+    auto& orders = oc.orders;
+    orders.reserve(nOrders);
+    for (uint64_t i = 0; i < nOrders; ++i)
+    {
+      PackedOrder p{};
+      memcpy(&p, packed + i * sizeof(PackedOrder), sizeof(PackedOrder));
+      auto& e = orders[orders.acquire()];
+      e.record = OrderRecord{p.securityId, p.user, p.company, p.qty, static_cast<Side>(p.side)};
+      e.orderId.assign(orderIds + p.orderIdOffset, p.orderIdLength);
+      e.live = true;
+      e.generation = 1;
+      e.userLinks = OrderLinks{p.userPrev, p.userNext};
+      e.secLinks = OrderLinks{p.secPrev, p.secNext};
+    }
+
+    oc.user_ordersid.resize(header.users);
+    copyBytes(oc.user_ordersid.data(), userLists, header.users * sizeof(OrderList));
+    oc.sec_ordersid.resize(header.securities);
+    copyBytes(oc.sec_ordersid.data(), secLists, header.securities * sizeof(OrderList));
+    oc.sec_totals = std::move(totals);
+
+    oc.sec_qtyindex.resize(header.securities);
+    vector<QtyEntry> entries{};
+    for (size_t secId = 0; secId < qtyIndexes.size(); ++secId)
+    {
+      entries.resize(qtyIndexes[secId].second);
+      copyBytes(entries.data(), qtyIndexes[secId].first, entries.size() * sizeof(QtyEntry));
+      oc.sec_qtyindex[secId].assign(entries.data(), entries.data() + entries.size());
+    }
+
+    oc.order_index.restore(dist, slots, capacity, nOrders);
+    if (sequence) *sequence = header.sequence;
+    return true;
+  }
+};
@@ -1,5 +1,18 @@
 #include "OrderCache.h"
+#include "ShardedOrderCache.h"
+#include "SnapshotOrderCache.h"
+#include "QueuedOrderCache.h"
+#include "OrderCacheSnapshot.h"
+#include "OrderJournal.h"
+#include "OrderWorkload.h"
+#include "OrderCacheJson.h"
 #include "json.hpp"
+#include <map>
+#include <queue>
+#include <sstream>
+#include <iterator>
+#include <random>
+#include <ctime>
 using jsn = nlohmann::json;
 
 jsn createJsonOrder (Order o)
@@ -27,6 +40,14 @@ jsn createJsonOrder (const std::string& ordId, const std::string& secId, const s
   return j;
 }
 
+//Purpose: the orders of c as a set of json dumps, to compare two caches whatever their order.
+set<std::string> dumpAll(const OrderCache& c)
+{
+  set<std::string> dumps{};
+  for (auto& o : c.getAllOrders()) dumps.insert(createJsonOrder(o).dump());
+  return dumps;
+}
+
 
 bool AddOrderTest(vector<Order> os)
 {
@@ -58,7 +79,7 @@ bool AddOrderTest(vector<Order> os)
   {
     auto orderid_undertest = j["orderid"];
     /* Check the order is in the cache */
-    auto orderFound = oc.find(orderid_undertest) != oc.end();
+    auto orderFound = oc.hasOrder(orderid_undertest);
     if (!orderFound) 
     {
       cout << string{ __FILE__} + ":" << __LINE__ << std::string{" order not found in cache "} << endl;
@@ -66,7 +87,7 @@ bool AddOrderTest(vector<Order> os)
     }
 
     auto jdump = j.dump();
-    auto cachedump = createJsonOrder(oc[orderid_undertest]).dump();
+    auto cachedump = createJsonOrder(oc.getOrder(orderid_undertest)).dump();
 
     if (jdump != cachedump)
     {
@@ -92,7 +113,7 @@ bool CancelOrderTest(vector<Order> os)
   {
     auto oid = o.orderId();
     oc.cancelOrder(oid);
-    if (oc.find(oid) != oc.end())
+    if (oc.hasOrder(oid))
     {
       cout << string{__FILE__} + ":" << __LINE__ << std::string{"order cancelling didn't take place: "} << oid << endl;
       return false;
@@ -119,7 +140,7 @@ bool CancelOrderForUserTest(vector<Order> os)
   oc.cancelOrdersForUser(user);
   if (any_of(ordersbyuser.begin(), ordersbyuser.end(), [&](auto& oid) -> bool
     {
-      if(oc.find(oid) != oc.end())
+      if(oc.hasOrder(oid))
       {
         cout << string{__FILE__} + ": " << __LINE__ << std::string{"order cancelling didn't take place: "} << oid << endl;
         return true;
@@ -151,7 +172,7 @@ bool CancelOrdersForSecIdWithMinimumQtyTest(vector<Order> os)
   //All orders should remain
   if (any_of(os.begin(), os.end(), [&](auto&o) -> bool
   {
-    if (oc.find(o.orderId()) == oc.end())
+    if (!oc.hasOrder(o.orderId()))
     {
       cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" orderid not found: "} << o.orderId() << endl;
       return true;
@@ -170,7 +191,7 @@ bool CancelOrdersForSecIdWithMinimumQtyTest(vector<Order> os)
   //NO orders should remain
   if (any_of(os.begin(), os.end(), [&](auto&o) -> bool
   {
-    if (oc.find(o.orderId()) != oc.end())
+    if (oc.hasOrder(o.orderId()))
     {
       cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" orderid found: "} << o.orderId() << endl;
       return true;
@@ -184,6 +205,582 @@ bool CancelOrdersForSecIdWithMinimumQtyTest(vector<Order> os)
 
 }
 
+bool CancelOrdersForSecIdWithMinimumQtyChurnTest()
+{
+  //Random adds/cancels (reusing arena handles) between qty threshold cancels, against a plain map.
+  std::mt19937 rng{11};
+  OrderCache oc;
+  map<string, Order> expected{};
+  for (int i = 0; i < 20000; ++i)
+  {
+    auto orderId = "OrdId" + to_string(rng() % 2000);
+    auto op = rng() % 10;
+    if (op < 6)
+    {
+      Order o(orderId, "SecId" + to_string(rng() % 3), "Buy", 100 * (1 + rng() % 30), "User1", "Company1");
+      oc.addOrder(o);
+      expected.emplace(orderId, o);
+    }
+    else if (op < 9)
+    {
+      oc.cancelOrder(orderId);
+      expected.erase(orderId);
+    }
+    else
+    {
+      auto secId = "SecId" + to_string(rng() % 3);
+      unsigned int minQty = 100 * (1 + rng() % 30);
+      oc.cancelOrdersForSecIdWithMinimumQty(secId, minQty);
+      for (auto it = expected.begin(); it != expected.end();)
+      {
+        auto cancelled = it->second.securityId() == secId && it->second.qty() >= minQty;
+        it = cancelled ? expected.erase(it) : next(it);
+      }
+    }
+  }
+
+  if (oc.size() != expected.size())
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad cache size: "} << oc.size() << " vs " << expected.size() << endl;
+    return false;
+  }
+  for (auto& kv : expected)
+  {
+    if (!oc.hasOrder(kv.first))
+    {
+      cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" orderid not found: "} << kv.first << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AddOrdersCancelOrdersTest(vector<Order> os)
+{
+  //Bulk calls end in the same state as one call per order, duplicates included.
+  auto batch = os;
+  batch.push_back(Order("OrdId1", "SecId9", "Buy", 1, "User1", "Company1"));
+  batch.insert(batch.end(), os.begin(), os.end());
+
+  OrderCache single;
+  for (auto& o : batch) single.addOrder(o);
+  OrderCache bulk;
+  bulk.addOrders(batch);
+
+  vector<string> cancelIds{"OrdId3", "OrdIdX", "OrdId5", "OrdId3"};
+  for (auto& orderId : cancelIds) single.cancelOrder(orderId);
+  bulk.cancelOrders(cancelIds);
+  //A single pass range goes through whole.
+  std::istringstream moreIds{"OrdId7 OrdId9"};
+  single.cancelOrder("OrdId7");
+  single.cancelOrder("OrdId9");
+  bulk.cancelOrders(istream_iterator<std::string>{moreIds}, istream_iterator<std::string>{});
+
+  if (bulk.size() != single.size() || bulk.getSecs() != single.getSecs())
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad bulk cache size: "} << bulk.size() << endl;
+    return false;
+  }
+  for (auto& o : single.getAllOrders())
+  {
+    if (createJsonOrder(bulk.getOrder(o.orderId())).dump() != createJsonOrder(o).dump())
+    {
+      cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" orderid under test: "} << o.orderId() << endl;
+      return false;
+    }
+  }
+  for (auto& secId : single.getSecs())
+  {
+    if (bulk.getMatchingSizeForSecurity(secId) != single.getMatchingSizeForSecurity(secId))
+    {
+      cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad matched qty for: "} << secId << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool EmplaceOrderTest()
+{
+  //Fields as views into a receive buffer, nothing but the cache itself copies them.
+  std::string buffer{"OrdId1|SecId2|Sell|3000|User2|CompanyB"};
+  std::string_view view{buffer};
+  vector<std::string_view> fields{};
+  for (size_t from = 0, to = 0; to != std::string_view::npos; from = to + 1)
+  {
+    to = view.find('|', from);
+    fields.push_back(view.substr(from, to == std::string_view::npos ? to : to - from));
+  }
+
+  OrderCache oc;
+  oc.emplaceOrder(fields[0], fields[1], fields[2], 3000, fields[4], fields[5]);
+  buffer.assign(buffer.size(), '#');
+
+  auto jdump = createJsonOrder("OrdId1", "SecId2", "Sell", 3000, "User2", "CompanyB").dump();
+  if (createJsonOrder(oc.getOrder("OrdId1")).dump() != jdump)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" emplaced order differs"} << endl;
+    return false;
+  }
+
+  //A moved Order hands its strings over instead of copying them (id longer than the small string buffer).
+  Order o{"OrdId2-with-an-id-too-long-for-sso", "SecId2", "Buy", 600, "User4", "CompanyC"};
+  auto data = o.orderIdRef().data();
+  Order moved{std::move(o)};
+  if (moved.orderIdRef().data() != data)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" order id copied on move"} << endl;
+    return false;
+  }
+  oc.addOrder(std::move(moved));
+  if (!oc.hasOrder("OrdId2-with-an-id-too-long-for-sso"))
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" moved order not added"} << endl;
+    return false;
+  }
+  return true;
+}
+
+bool ForEachOrderTest(vector<Order> os)
+{
+  OrderCache oc;
+  ShardedOrderCache sharded{4};
+  for (auto& o : os)
+  {
+    oc.addOrder(o);
+    sharded.addOrder(o);
+  }
+  //Leave holes in the arena and in the lists.
+  for (auto orderId : {"OrdId1", "OrdId6", "OrdId11"})
+  {
+    oc.cancelOrder(orderId);
+    sharded.cancelOrder(orderId);
+  }
+
+  //Every combination of filters against a plain scan of the orders left.
+  vector<std::string> secs{"", "SecId1", "SecId2", "SecId3", "SecIdX"};
+  vector<std::string> users{"", "User10", "User13", "User2", "UserX"};
+  vector<std::string> comps{"", "Company1", "Company2", "CompanyX"};
+  for (auto& sec : secs) for (auto& user : users) for (auto& comp : comps)
+  {
+    OrderFilter filter{sec, user, comp};
+    set<std::string> expected{};
+    for (auto& o : os)
+    {
+      if (!oc.hasOrder(o.orderIdRef())) continue;
+      if ((sec.empty() || o.securityIdRef() == sec) && (user.empty() || o.userRef() == user) && (comp.empty() || o.companyRef() == comp))
+      {
+        expected.insert(createJsonOrder(o).dump());
+      }
+    }
+
+    set<std::string> visited{}, ranged{}, shardVisited{};
+    oc.forEachOrder(filter, [&](const OrderView& v) { visited.insert(createJsonOrder(v.toOrder()).dump()); });
+    for (auto v : oc.viewOrders(filter)) ranged.insert(createJsonOrder(v.toOrder()).dump());
+    sharded.forEachOrder(filter, [&](const OrderView& v) { shardVisited.insert(createJsonOrder(v.toOrder()).dump()); });
+    if (visited != expected || ranged != expected || shardVisited != expected)
+    {
+      cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad orders for filter "} << sec << "/" << user << "/" << comp << endl;
+      return false;
+    }
+  }
+
+  size_t n = 0;
+  oc.forEachOrder([&](const OrderView&) { ++n; });
+  if (n != oc.size() || std::distance(oc.viewOrders().begin(), oc.viewOrders().end()) != static_cast<ptrdiff_t>(n))
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" forEachOrder() misses orders"} << endl;
+    return false;
+  }
+  return true;
+}
+
+bool SnapshotSaveLoadTest(vector<Order> os)
+{
+  OrderCache oc;
+  for (auto& o : os) oc.addOrder(o);
+  //Holes in the arena, reused handles and stale qty index entries must not leak into the snapshot.
+  oc.cancelOrder("OrdId3");
+  oc.cancelOrdersForUser("User10");
+  oc.addOrder(Order{"OrdId14", "SecId1", "Buy", 400, "User14", "Company1"});
+
+  std::string path{"OrderCacheTest.snapshot"};
+  OrderCache loaded;
+  if (!OrderCacheSnapshot::save(oc, path) || !OrderCacheSnapshot::load(loaded, path))
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" snapshot save/load failed"} << endl;
+    return false;
+  }
+
+  bool ok = dumpAll(loaded) == dumpAll(oc) && loaded.getMatchingSizeForAllSecurities() == oc.getMatchingSizeForAllSecurities();
+  ok = ok && loaded.getUserOrders("User13") == oc.getUserOrders("User13") && loaded.hasOrder("OrdId14") && !loaded.hasOrder("OrdId1");
+
+  //Both caches keep behaving the same after the restart.
+  for (auto* c : {&oc, &loaded})
+  {
+    c->cancelOrdersForSecIdWithMinimumQty("SecId2", 1000);
+    c->cancelOrder("OrdId5");
+    c->addOrder(Order{"OrdId15", "SecId3", "Buy", 700, "User13", "Company1"});
+  }
+  ok = ok && dumpAll(loaded) == dumpAll(oc) && loaded.getMatchingSizeForAllSecurities() == oc.getMatchingSizeForAllSecurities();
+  ok = ok && loaded.getUserOrders("User13") == oc.getUserOrders("User13");
+
+  //A flipped bit fails the checksum.
+  {
+    std::fstream flip{path, std::ios::binary | std::ios::in | std::ios::out};
+    flip.seekg(0, std::ios::end);
+    auto middle = static_cast<std::streamoff>(flip.tellg()) / 2;
+    char byte{};
+    flip.seekg(middle);
+    flip.get(byte);
+    flip.seekp(middle);
+    flip.put(static_cast<char>(byte ^ 0x10));
+  }
+  OrderCache flipped;
+  ok = ok && !OrderCacheSnapshot::load(flipped, path) && flipped.size() == 0;
+  OrderCacheSnapshot::save(oc, path);
+
+  //Empty sections (an empty cache, a security with no live qty entry) go through save and load.
+  OrderCache emptied, reloaded;
+  emptied.addOrder(Order{"OrdId1", "SecId1", "Buy", 100, "User1", "Company1"});
+  emptied.cancelOrder("OrdId1");
+  ok = ok && OrderCacheSnapshot::save(OrderCache{}, path) && OrderCacheSnapshot::load(reloaded, path) && reloaded.size() == 0;
+  OrderCache reloadedEmptied;
+  ok = ok && OrderCacheSnapshot::save(emptied, path) && OrderCacheSnapshot::load(reloadedEmptied, path) && reloadedEmptied.size() == 0;
+  OrderCacheSnapshot::save(oc, path);
+
+  //A truncated file and a cache that is not empty are turned down, the cache is left as it was.
+  {
+    std::ifstream in{path, std::ios::binary};
+    std::string bytes{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+    std::ofstream{path, std::ios::binary | std::ios::trunc}.write(bytes.data(), static_cast<std::streamsize>(bytes.size() / 2));
+  }
+  OrderCache truncated;
+  ok = ok && !OrderCacheSnapshot::load(truncated, path) && truncated.size() == 0 && truncated.getSecs().empty();
+  ok = ok && !OrderCacheSnapshot::load(loaded, path) && !OrderCacheSnapshot::load(truncated, "missing.snapshot");
+  //An empty file opens (and is no snapshot), a missing one doesn't.
+  std::ofstream{path, std::ios::binary | std::ios::trunc};
+  {
+    MappedFile emptyFile{path}, missingFile{"missing.snapshot"};
+    ok = ok && emptyFile.ok() && emptyFile.size() == 0 && !missingFile.ok() && !OrderCacheSnapshot::load(truncated, path);
+  }
+  //Nothing is left behind by a save that went through or one that could not start.
+  ok = ok && !std::ifstream{path + ".tmp"} && !OrderCacheSnapshot::save(oc, "missing/dir/x.snapshot");
+  std::remove(path.c_str());
+  if (!ok)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" loaded snapshot differs"} << endl;
+    return false;
+  }
+  return true;
+}
+
+bool JournalRecoveryTest(vector<Order> os)
+{
+  std::string snapshotPath{"OrderCacheTest.jsnapshot"}, journalPath{"OrderCacheTest.journal"};
+  std::remove(snapshotPath.c_str());
+  std::remove(journalPath.c_str());
+
+  //The same mutations go to a plain cache, the journaled one must come back equal to it.
+  OrderCache expected;
+  JournalOptions options{};
+  options.groupEntries = 4;
+  options.fsync = false;
+  bool ok = true;
+  {
+    JournaledOrderCache joc{snapshotPath, journalPath, options};
+    for (auto& o : os)
+    {
+      joc.addOrder(o);
+      expected.addOrder(o);
+    }
+    joc.checkpoint();
+    for (auto* c : std::initializer_list<OrderCacheInterface*>{&joc, &expected})
+    {
+      c->cancelOrder("OrdId2");
+      c->cancelOrdersForUser("User10");
+      c->cancelOrdersForSecIdWithMinimumQty("SecId2", 1000);
+      c->addOrder(Order{"OrdId14", "SecId2", "Buy", 1500, "User1", "Company1"});
+    }
+    ok = ok && joc.log().lastSequence() == os.size() + 4;
+  }
+  {
+    //Snapshot (13 adds) + journal tail (4 entries, the bulk cancels one entry each).
+    JournaledOrderCache joc{snapshotPath, journalPath, options};
+    ok = ok && joc.recovery().applied == 4 && dumpAll(joc.cache()) == dumpAll(expected);
+    ok = ok && joc.cache().getMatchingSizeForAllSecurities() == expected.getMatchingSizeForAllSecurities();
+  }
+
+  //A torn write at the end of the journal is dropped, and what is appended after it is kept.
+  {
+    std::ofstream torn{journalPath, std::ios::binary | std::ios::app};
+    torn.write("\x20\x00\x00\x00\x01torn", 9);
+  }
+  {
+    JournaledOrderCache joc{snapshotPath, journalPath, options};
+    ok = ok && joc.recovery().applied == 4 && dumpAll(joc.cache()) == dumpAll(expected);
+    joc.cancelOrder("OrdId14");
+    expected.cancelOrder("OrdId14");
+  }
+  {
+    JournaledOrderCache joc{snapshotPath, journalPath, options};
+    ok = ok && joc.recovery().applied == 5 && dumpAll(joc.cache()) == dumpAll(expected);
+  }
+
+  //A snapshot that is there but unreadable fails the recovery instead of replaying the journal alone.
+  {
+    std::ofstream corrupt{snapshotPath, std::ios::binary | std::ios::trunc};
+    corrupt << "not a snapshot";
+  }
+  {
+    JournaledOrderCache joc{snapshotPath, journalPath, options};
+    joc.addOrder(Order{"OrdId15", "SecId1", "Buy", 100, "User1", "Company1"});
+    ok = ok && !joc.recovery().ok && !joc.recovery().error.empty() && joc.cache().size() == 0 && !joc.checkpoint();
+  }
+  //So does a journal that can't be opened.
+  {
+    JournaledOrderCache joc{"/nonexistent/dir/snapshot", "/nonexistent/dir/journal", options};
+    joc.addOrder(Order{"OrdId15", "SecId1", "Buy", 100, "User1", "Company1"});
+    ok = ok && !joc.recovery().ok && !joc.log().good() && joc.cache().size() == 0;
+  }
+  std::remove(snapshotPath.c_str());
+  std::remove(journalPath.c_str());
+  if (!ok)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" recovered book differs"} << endl;
+    return false;
+  }
+  return true;
+}
+
+bool LoadOrdersJsonTest(vector<Order> os)
+{
+  jsn jorders = jsn::array();
+  for (auto& o : os) jorders.push_back(createJsonOrder(o));
+  //Turned down: a duplicate id, a missing qty, a negative qty. Extra keys, however nested, are skipped.
+  jorders.push_back(createJsonOrder("OrdId1", "SecId9", "Buy", 1, "User1", "Company1"));
+  auto noQty = createJsonOrder("OrdId20", "SecId9", "Buy", 1, "User1", "Company1");
+  noQty.erase("qty");
+  jorders.push_back(noQty);
+  auto negativeQty = createJsonOrder("OrdId21", "SecId9", "Buy", 1, "User1", "Company1");
+  negativeQty["qty"] = -5;
+  jorders.push_back(negativeQty);
+  auto extra = createJsonOrder("OrdId22", "SecId9", "Sell", 700, "User1", "Company1");
+  extra["meta"] = jsn::parse(R"({"qty": 1, "orderid": "X", "tags": [{"side": "Buy"}]})");
+  jorders.push_back(extra);
+
+  std::string path{"OrderCacheTest.json"};
+  std::ofstream{path} << jorders.dump();
+  OrderCache fromFile, fromStream;
+  auto fileResult = loadOrdersJson(fromFile, path);
+  std::istringstream in{jorders.dump()};
+  auto streamResult = loadOrdersJson(fromStream, in);
+  std::remove(path.c_str());
+
+  OrderCache expected;
+  for (auto& o : os) expected.addOrder(o);
+  expected.addOrder(Order{"OrdId22", "SecId9", "Sell", 700, "User1", "Company1"});
+  bool ok = fileResult.ok && fileResult.added == os.size() + 1 && fileResult.rejected == 3 && dumpAll(fromFile) == dumpAll(expected);
+  ok = ok && streamResult.ok && streamResult.added == fileResult.added && dumpAll(fromStream) == dumpAll(expected);
+
+  //Malformed input stops the load with a message, what came before it stays in.
+  OrderCache partial;
+  std::istringstream broken{R"([{"orderid":"OrdId1","securityid":"SecId1","side":"Buy","qty":10,"user":"U","company":"C"}, {"orderid": )"};
+  auto brokenResult = loadOrdersJson(partial, broken);
+  ok = ok && !brokenResult.ok && !brokenResult.error.empty() && partial.size() == 1;
+  std::istringstream notArray{R"({"orderid":"OrdId1"})"};
+  ok = ok && !loadOrdersJson(partial, notArray).ok;
+  if (!ok)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad JSON load "} << fileResult.added << "/" << fileResult.rejected << " " << fileResult.error << endl;
+    return false;
+  }
+  return true;
+}
+
+bool ColumnarExportImportTest(vector<Order> os)
+{
+  OrderCache oc;
+  for (auto& o : os) oc.addOrder(o);
+  oc.cancelOrdersForUser("User10");
+
+  OrderCache fromCbor, fromMsgpack, fromJson;
+  auto cbor = OrderCacheColumnar::toCbor(oc);
+  bool ok = OrderCacheColumnar::fromCbor(fromCbor, cbor) && dumpAll(fromCbor) == dumpAll(oc);
+  ok = ok && OrderCacheColumnar::fromMsgpack(fromMsgpack, OrderCacheColumnar::toMsgpack(oc)) && dumpAll(fromMsgpack) == dumpAll(oc);
+  auto columns = OrderCacheColumnar::toJson(oc);
+  ok = ok && OrderCacheColumnar::fromJson(fromJson, columns) && dumpAll(fromJson) == dumpAll(oc);
+  for (auto secId : {"SecId1", "SecId2", "SecId3"}) ok = ok && fromCbor.getMatchingSizeForSecurity(secId) == oc.getMatchingSizeForSecurity(secId);
+
+  //Malformed books are turned down whole: short column, index out of the name table, bad version, bad bytes.
+  OrderCache rejected;
+  auto shortColumn = columns;
+  shortColumn["qty"].erase(0);
+  auto badIndex = columns;
+  badIndex["user"][0] = columns["users"].size();
+  auto badVersion = columns;
+  badVersion["version"] = "1";
+  ok = ok && !OrderCacheColumnar::fromJson(rejected, shortColumn) && !OrderCacheColumnar::fromJson(rejected, badIndex);
+  ok = ok && !OrderCacheColumnar::fromJson(rejected, badVersion) && !OrderCacheColumnar::fromCbor(rejected, nlohmann::json::to_cbor(badVersion));
+  cbor.resize(cbor.size() / 2);
+  ok = ok && !OrderCacheColumnar::fromCbor(rejected, cbor) && !OrderCacheColumnar::fromMsgpack(rejected, {0xc1}) && rejected.size() == 0;
+  if (!ok)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" columnar round trip differs"} << endl;
+    return false;
+  }
+  return true;
+}
+
+bool LatencyStatsTest(vector<Order> os)
+{
+  //Percentiles within the histogram precision (1/32 of the value), max exact.
+  LatencyHistogram<> h{};
+  for (std::uint64_t v = 1; v <= 10000; ++v) h.record(v);
+  auto near = [](std::uint64_t got, std::uint64_t want) { return got >= want && got <= want + want / 32; };
+  bool ok = h.count() == 10000 && near(h.percentile(0.5), 5000) && near(h.percentile(0.99), 9900) && near(h.percentile(0.999), 9990) && h.max() == 10000;
+  h.record(1ull << 45);
+  ok = ok && h.max() == 1ull << 45 && h.percentile(1.0) == 1ull << 45;
+
+  OrderCache oc;
+  for (auto& o : os) oc.addOrder(o);
+  oc.cancelOrder("OrdId1");
+  oc.cancelOrdersForUser("User13");
+  oc.cancelOrdersForSecIdWithMinimumQty("SecId2", 1000);
+  oc.getMatchingSizeForSecurity("SecId1");
+  oc.getAllOrders();
+  auto stats = oc.stats();
+  //Without ORDERCACHE_STATS nothing is measured.
+  std::uint64_t n = OrderCacheStats::enabled ? 1 : 0;
+  ok = ok && stats.addOrder.count == n * os.size() && stats.cancelOrder.count == n && stats.cancelOrdersForUser.count == n;
+  ok = ok && stats.cancelOrdersForSecIdWithMinimumQty.count == n && stats.getMatchingSizeForSecurity.count == n && stats.getAllOrders.count == n;
+  ok = ok && stats.addOrder.p50 <= stats.addOrder.p99 && stats.addOrder.p99 <= stats.addOrder.max;
+  oc.resetStats();
+  ok = ok && oc.stats().addOrder.count == 0;
+  if (!ok)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad latency stats"} << endl << stats;
+    return false;
+  }
+  return true;
+}
+
+bool MemoryUsageTest(vector<Order> os)
+{
+  OrderCache oc;
+  auto empty = oc.memoryUsage();
+  for (auto& o : os) oc.addOrder(o);
+  //An order id past the small string buffer is counted under orderIds.
+  oc.addOrder({"OrdIdWithAVeryLongNameThatDoesNotFitInline", "SecId1", "Buy", 100, "User1", "CompanyA"});
+  auto full = oc.memoryUsage();
+  //An empty cache holds next to nothing (the name tables reserve their deque maps), no order storage.
+  bool ok = empty.orders == 0 && empty.orderIndex == 0 && empty.total() < full.total() && full.liveOrders == os.size() + 1 && full.orders > 0 && full.orderIds > 0 && full.orderIndex > 0;
+  ok = ok && full.userOrders > 0 && full.securityOrders > 0 && full.qtyIndexes > 0 && full.totals > 0 && full.names > 0;
+  ok = ok && full.perOrder(full.total()) > 0;
+
+  //A cancelled slot keeps its id buffer for the next order: cancel and re-add grows nothing.
+  oc.cancelOrder("OrdIdWithAVeryLongNameThatDoesNotFitInline");
+  auto cancelled = oc.memoryUsage();
+  oc.addOrder({"OrdIdWithAVeryLongNameThatDoesNotFitInline", "SecId1", "Buy", 100, "User1", "CompanyA"});
+  auto readded = oc.memoryUsage();
+  ok = ok && cancelled.liveOrders == os.size() && cancelled.orderIds == full.orderIds && readded.total() == cancelled.total();
+  if (!ok)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad memory usage"} << endl << full << cancelled << readded;
+    return false;
+  }
+  return true;
+}
+
+bool WorkloadTest()
+{
+  std::string path{"OrderCacheTest.workload"}, again{"OrderCacheTest2.workload"};
+  WorkloadOptions options{};
+  options.operations = 20000;
+  options.securities = 100;
+  options.users = 50;
+  options.companies = 10;
+  bool ok = options.set("zipf=1.2") && !options.set("zipf=x") && !options.set("nosuchknob=1") && writeWorkload(options, path) && writeWorkload(options, again);
+
+  //Values that don't fit a knob are turned down, not narrowed, and so is a mix with nothing in it.
+  ok = ok && !options.set("users=4294967296") && !options.set("operations=1.5") && !options.set("seed=-1") && !options.set("zipf=1e999");
+  ok = ok && options.set("seed=18446744073709551615") && options.seed == ~0ull && options.set("seed=42");
+  WorkloadOptions empty{};
+  for (auto weight : {"add=0", "cancel=0", "cancelUser=0", "cancelSecMinQty=0", "match=0"}) ok = ok && empty.set(weight);
+  ok = ok && !empty.valid() && !writeWorkload(empty, "empty.workload") && !std::ifstream{"empty.workload"};
+
+  //Same seed, same file.
+  {
+    MappedFile a{path}, b{again};
+    ok = ok && a.ok() && b.ok() && a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+  }
+
+  //The mix is about the weights, the hottest security is SecId0 and order sizes are whole lots.
+  size_t counts[5]{}, hottest{0}, second{0};
+  bool lots = true;
+  auto tail = WorkloadFile::read(path, [&](const JournalCodec::Entry& e)
+  {
+    ++counts[static_cast<int>(e.op) - 1];
+    if (e.op == JournalCodec::Op::Add || e.op == WorkloadFile::Match)
+    {
+      hottest += e.securityId == "SecId0";
+      second += e.securityId == "SecId1";
+    }
+    if (e.op == JournalCodec::Op::Add) lots = lots && e.qty > 0 && e.qty % options.qtyLot == 0 && e.qty <= options.qtyMax;
+  });
+  auto near = [&](size_t count, double weight) { return std::abs(static_cast<double>(count) / options.operations - weight) < 0.02; };
+  ok = ok && tail.applied == options.operations && near(counts[0], 0.5) && near(counts[1], 0.3) && near(counts[4], 0.19);
+  ok = ok && counts[2] > 0 && counts[3] > 0 && hottest > second && second > 0 && lots;
+
+  //replay() and a timed replay through read() and apply() leave the same book.
+  OrderCache replayed, applied;
+  WorkloadFile::replay(replayed, path);
+  WorkloadFile::read(path, [&](const JournalCodec::Entry& e) { WorkloadFile::apply(applied, e); });
+  ok = ok && replayed.size() > 0 && replayed.size() == applied.size();
+  ok = ok && replayed.getMatchingSizeForAllSecurities() == applied.getMatchingSizeForAllSecurities();
+
+  //A Match is not a journal entry: a journal reader stops at the first one.
+  ok = ok && OrderJournal::read(path, 0, [](const OrderJournal::Entry&) {}).applied < options.operations;
+  std::remove(path.c_str());
+  std::remove(again.c_str());
+  if (!ok)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad workload"} << endl;
+    return false;
+  }
+  return true;
+}
+
+bool StringViewLookupTest(vector<Order> matchTestOs)
+{
+  //Ids as views into a network buffer go straight to the indexes.
+  OrderCache oc;
+  for (auto& o : matchTestOs) oc.addOrder(o);
+
+  std::string buffer{"OrdId4 SecId2 User2 OrdIdX"};
+  std::string_view view{buffer};
+  auto orderId = view.substr(0, 6), secId = view.substr(7, 6), user = view.substr(14, 5), unknown = view.substr(20, 6);
+
+  bool ok = oc.hasOrder(orderId) && !oc.hasOrder(unknown) && oc.getOrder(orderId).qty() == 600;
+  ok = ok && oc.getMatchingSizeForSecurity(secId) == 2700;
+
+  oc.cancelOrder(orderId);
+  oc.cancelOrder(unknown);
+  ok = ok && !oc.hasOrder(orderId) && oc.getMatchingSizeForSecurity(secId) == 2100;
+
+  oc.cancelOrdersForUser(user);
+  ok = ok && !oc.hasOrder("OrdId2") && oc.getMatchingSizeForSecurity(secId) == 100;
+
+  oc.cancelOrdersForSecIdWithMinimumQty(secId, 0);
+  ok = ok && oc.getMatchingSizeForSecurity(secId) == 0 && oc.size() == 3;
+  if (!ok)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad string_view lookup"} << endl;
+    return false;
+  }
+  return true;
+}
+
 bool GetMatchingSizeForSecurityTest(vector<Order> matchTestOs, const std::string& secId, unsigned int qtyMatchTest)
 {
   OrderCache oc;
@@ -202,6 +799,415 @@ bool GetMatchingSizeForSecurityTest(vector<Order> matchTestOs, const std::string
   return true;
 }
 
+bool GetMatchingSizeAfterCancelTest(vector<Order> matchTestOs, const std::string& secId)
+{
+  /* The matching size is served from running totals: after every kind of cancel it must be
+  the same as the one of a cache built from scratch with the surviving orders only. */
+  OrderCache oc;
+  for (auto& o : matchTestOs)
+  {
+    oc.addOrder(o);
+  }
+
+  oc.cancelOrder(matchTestOs[0].orderId());
+  oc.cancelOrdersForUser(matchTestOs[1].user());
+  oc.cancelOrdersForSecIdWithMinimumQty(secId, 2000);
+
+  OrderCache fresh;
+  for (auto& o : oc.getAllOrders())
+  {
+    fresh.addOrder(o);
+  }
+
+  auto qtyMatch = oc.getMatchingSizeForSecurity(secId);
+  auto qtyMatchTest = fresh.getMatchingSizeForSecurity(secId);
+  if (qtyMatch != qtyMatchTest)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad matched qty after cancel: "} << qtyMatch << " vs " << qtyMatchTest << endl;
+    return false;
+  }
+  return true;
+}
+
+//Reference: plain Edmonds-Karp max flow over single orders (source -> buy -> sell -> sink).
+unsigned long long MaxFlowMatchingSize(const vector<Order>& os, const std::string& secId)
+{
+  vector<Order> book{};
+  for (auto& o : os) if (o.securityId() == secId) book.push_back(o);
+
+  auto n = book.size() + 2;
+  auto source = book.size(), sink = book.size() + 1;
+  vector<vector<unsigned long long>> cap(n, vector<unsigned long long>(n, 0));
+  for (size_t i = 0; i < book.size(); ++i)
+  {
+    if (book[i].side() == "Buy") cap[source][i] = book[i].qty();
+    else cap[i][sink] = book[i].qty();
+    for (size_t j = 0; j < book.size(); ++j)
+    {
+      bool edge = book[i].side() == "Buy" && book[j].side() != "Buy" && book[i].company() != book[j].company();
+      if (edge) cap[i][j] = ~0ull;
+    }
+  }
+
+  unsigned long long flow{0};
+  while (true)
+  {
+    vector<size_t> parent(n, n);
+    queue<size_t> q{};
+    q.push(source);
+    parent[source] = source;
+    while (!q.empty() && parent[sink] == n)
+    {
+      auto u = q.front(); q.pop();
+      for (size_t v = 0; v < n; ++v) if (parent[v] == n && cap[u][v] > 0) { parent[v] = u; q.push(v); }
+    }
+    if (parent[sink] == n) break;
+
+    auto bottleneck = ~0ull;
+    for (auto v = sink; v != source; v = parent[v]) bottleneck = min(bottleneck, cap[parent[v]][v]);
+    for (auto v = sink; v != source; v = parent[v])
+    {
+      cap[parent[v]][v] -= bottleneck;
+      if (cap[v][parent[v]] != ~0ull) cap[v][parent[v]] += bottleneck;
+    }
+    flow += bottleneck;
+  }
+  return flow;
+}
+
+bool MatchingEngineMaxFlowTest()
+{
+  std::mt19937 rng{20231017};
+  for (int round = 0; round < 200; ++round)
+  {
+    vector<Order> os{};
+    auto nOrders = 1 + rng() % 10;
+    for (unsigned int i = 0; i < nOrders; ++i)
+    {
+      os.emplace_back("OrdId" + to_string(i), "SecId1", rng() % 2 ? "Buy" : "Sell", 100 * (1 + rng() % 20), "User" + to_string(i), "Company" + to_string(rng() % 4));
+    }
+
+    OrderCache oc;
+    for (auto& o : os) oc.addOrder(o);
+
+    auto expected = MaxFlowMatchingSize(os, "SecId1");
+    auto qtyMatch = oc.getMatchingSizeForSecurity("SecId1");
+    auto collapsed = MatchingEngine::solve(MatchingEngine::collapse(os.begin(), os.end(), "SecId1"));
+    if (qtyMatch != expected || collapsed != expected)
+    {
+      cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad matched qty: "} << qtyMatch << " expected " << expected << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool GetMatchingSizeForAllSecuritiesTest(vector<Order> matchTestOs)
+{
+  OrderCache oc;
+  for (auto& o : matchTestOs)
+  {
+    oc.addOrder(o);
+  }
+
+  auto table = oc.getMatchingSizeForAllSecurities();
+  if (table.size() != oc.getSecs().size())
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad number of securities: "} << table.size() << endl;
+    return false;
+  }
+  for (auto& row : table)
+  {
+    if (row.second != oc.getMatchingSizeForSecurity(row.first))
+    {
+      cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad matched qty for: "} << row.first << endl;
+      return false;
+    }
+  }
+
+  WorkStealingPool pool{4};
+  SecuritiesMatchingSize parallelTable{};
+  oc.getMatchingSizeForAllSecurities(pool, parallelTable, 1);
+  if (parallelTable != table)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" parallel table differs from sequential one"} << endl;
+    return false;
+  }
+
+  auto rows = oc.getMatchingSizeForSecurities({"SecId3", "SecIdX", "SecId1"});
+  if (rows.size() != 3 || rows[0].first != "SecId3" || rows[1].second != 0 || rows[2].second != oc.getMatchingSizeForSecurity("SecId1"))
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad rows for the given securities"} << endl;
+    return false;
+  }
+  return true;
+}
+
+bool AddCancelChurnTest()
+{
+  //Heavy add/cancel churn against a plain set: the order id index must never lose or keep an order.
+  std::mt19937 rng{7};
+  OrderCache oc;
+  set<string> expected{};
+  for (int i = 0; i < 20000; ++i)
+  {
+    auto orderId = "OrdId" + to_string(rng() % 3000);
+    if (rng() % 3)
+    {
+      oc.addOrder(Order(orderId, "SecId" + to_string(rng() % 5), rng() % 2 ? "Buy" : "Sell", 100, "User" + to_string(rng() % 50), "Company1"));
+      expected.insert(orderId);
+    }
+    else
+    {
+      oc.cancelOrder(orderId);
+      expected.erase(orderId);
+    }
+  }
+
+  if (oc.size() != expected.size())
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad cache size: "} << oc.size() << endl;
+    return false;
+  }
+  for (auto& o : oc.getAllOrders())
+  {
+    if (!expected.count(o.orderId()) || oc.getOrder(o.orderId()).securityId() != o.securityId())
+    {
+      cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" unexpected order: "} << o.orderId() << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+//Purpose: memory resource counting what reaches the heap.
+class CountingResource : public pmr::memory_resource
+{
+public:
+  size_t allocations{0};
+
+private:
+  void* do_allocate(size_t bytes, size_t alignment) override
+  {
+    ++allocations;
+    return pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override
+  {
+    pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const pmr::memory_resource& other) const noexcept override
+  {
+    return this == &other;
+  }
+};
+
+bool SteadyStateAllocationTest()
+{
+  CountingResource heap{};
+  pmr::unsynchronized_pool_resource pool{&heap};
+  OrderCache oc{&pool};
+
+  auto cycle = [&](int round)
+  {
+    for (int i = 0; i < 1000; ++i)
+    {
+      oc.addOrder(Order("OrderId-" + to_string(round) + "-" + to_string(1000 + i) + "-with-a-long-tail", "SecId" + to_string(i % 10), i % 2 ? "Buy" : "Sell", 100, "User" + to_string(i % 20), "Company" + to_string(i % 3)));
+    }
+    for (int i = 0; i < 20; ++i)
+    {
+      oc.cancelOrdersForUser("User" + to_string(i));
+    }
+  };
+  cycle(0);
+  cycle(1);
+
+  auto warm = heap.allocations;
+  cycle(2);
+  if (heap.allocations != warm || oc.size() != 0)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" allocations in steady state: "} << heap.allocations - warm << endl;
+    return false;
+  }
+  return true;
+}
+
+bool ShardedOrderCacheTest(vector<Order> matchTestOs)
+{
+  //Same answers as OrderCache on the readme book...
+  ShardedOrderCache soc{4, 8};
+  OrderCache oc;
+  for (auto& o : matchTestOs)
+  {
+    soc.addOrder(o);
+    oc.addOrder(o);
+  }
+  for (auto& secId : oc.getSecs())
+  {
+    if (soc.getMatchingSizeForSecurity(secId) != oc.getMatchingSizeForSecurity(secId))
+    {
+      cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad matched qty for: "} << secId << endl;
+      return false;
+    }
+  }
+
+  //...and no lost or duplicated order when threads add, cancel and bulk cancel at once.
+  ShardedOrderCache concurrent{4, 8};
+  vector<thread> threads{};
+  for (int t = 0; t < 4; ++t)
+  {
+    threads.emplace_back([&concurrent, t]
+    {
+      for (int i = 0; i < 2000; ++i)
+      {
+        auto user = "User" + to_string(t);
+        concurrent.addOrder(Order("OrdId" + to_string(t) + "-" + to_string(i), "SecId" + to_string(i % 7), i % 2 ? "Buy" : "Sell", 100, user, "Company" + to_string(t)));
+        concurrent.addOrder(Order("OrdIdShared" + to_string(i), "SecId" + to_string(i % 7), "Buy", 100, "UserShared", "Company9"));
+        if (i % 3 == 0) concurrent.cancelOrder("OrdId" + to_string(t) + "-" + to_string(i / 2));
+        if (i % 500 == 499) concurrent.cancelOrdersForUser(user);
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+
+  auto allOrders = concurrent.getAllOrders();
+  set<string> ids{};
+  for (auto& o : allOrders) ids.insert(o.orderId());
+  if (ids.size() != allOrders.size() || allOrders.size() != concurrent.size() || concurrent.size() != 2000)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad order count: "} << allOrders.size() << " / " << concurrent.size() << endl;
+    return false;
+  }
+  return true;
+}
+
+bool SnapshotOrderCacheTest()
+{
+  //Readers check every view they get is self consistent while the writer keeps publishing.
+  SnapshotOrderCache soc{10};
+  atomic<bool> done{false};
+  atomic<bool> consistent{true};
+
+  vector<thread> readers{};
+  for (int r = 0; r < 3; ++r)
+  {
+    readers.emplace_back([&]
+    {
+      while (!done.load())
+      {
+        auto view = soc.read();
+        for (std::string secId : {"SecId0", "SecId1", "SecId2"})
+        {
+          auto sec = view->security(secId);
+          if (!sec) continue;
+          auto expected = MatchingEngine::solve(MatchingEngine::collapse(sec->orders.begin(), sec->orders.end(), secId));
+          if (sec->matchingSize != expected) consistent = false;
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < 3000; ++i)
+  {
+    soc.addOrder(Order("OrdId" + to_string(i), "SecId" + to_string(i % 3), i % 2 ? "Buy" : "Sell", 100 + i, "User" + to_string(i % 5), "Company" + to_string(i % 4)));
+    if (i % 7 == 0) soc.cancelOrder("OrdId" + to_string(i / 2));
+    if (i % 1000 == 999) soc.cancelOrdersForUser("User1");
+  }
+  soc.publish();
+  done = true;
+  for (auto& th : readers) th.join();
+
+  if (!consistent)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" inconsistent snapshot"} << endl;
+    return false;
+  }
+
+  OrderCache oc;
+  for (auto& o : soc.getAllOrders()) oc.addOrder(o);
+  bool ok = oc.size() == soc.read()->orderCount;
+  for (std::string secId : {"SecId0", "SecId1", "SecId2"}) ok = ok && soc.getMatchingSizeForSecurity(secId) == oc.getMatchingSizeForSecurity(secId);
+
+  //read() lags the writes until the next publish, the interface reads don't; a publish leaves the untouched securities shared.
+  SnapshotOrderCache batched{};
+  batched.addOrder(Order("OrdId1", "SecId1", "Buy", 100, "User1", "Company1"));
+  batched.addOrder(Order("OrdId2", "SecId1", "Sell", 100, "User2", "Company2"));
+  batched.addOrder(Order("OrdId3", "SecId2", "Sell", 100, "User2", "Company2"));
+  ok = ok && batched.read()->getMatchingSizeForSecurity("SecId1") == 0 && batched.read()->allOrders().empty();
+  ok = ok && batched.getMatchingSizeForSecurity("SecId1") == 100 && batched.getAllOrders().size() == 3;
+  auto before = batched.read();
+  ok = ok && before->getMatchingSizeForSecurity("SecId1") == 100 && before->orderCount == 3;
+  batched.cancelOrder("OrdId3");
+  ok = ok && batched.getAllOrders().size() == 2;
+  auto after = batched.read();
+  ok = ok && before->security("SecId1") == after->security("SecId1") && !after->security("SecId2") && before->security("SecId2");
+
+  //Cancels that remove nothing publish nothing.
+  batched.cancelOrdersForUser("User9");
+  batched.cancelOrdersForSecIdWithMinimumQty("SecId1", 1000);
+  batched.getAllOrders();
+  ok = ok && batched.read()->version == after->version;
+
+  //Past a few hundred securities the buckets double, every security keeps its snapshot.
+  OrderCache plain;
+  for (int i = 0; i < 2000; ++i)
+  {
+    Order o("OrdIdB" + to_string(i), "SecIdB" + to_string(i % 500), i % 3 ? "Buy" : "Sell", 100 + i, "User" + to_string(i % 7), "Company" + to_string(i % 5));
+    plain.addOrder(o);
+    batched.addOrder(std::move(o));
+  }
+  ok = ok && batched.getAllOrders().size() == 2002 && batched.read()->buckets.size() > before->buckets.size() && batched.read()->securityCount == 501;
+  for (int s = 0; s < 500; s += 37) ok = ok && batched.getMatchingSizeForSecurity("SecIdB" + to_string(s)) == plain.getMatchingSizeForSecurity("SecIdB" + to_string(s));
+  if (!ok)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad matched qty in the last snapshot"} << endl;
+    return false;
+  }
+  return true;
+}
+
+bool QueuedOrderCacheTest(vector<Order> matchTestOs)
+{
+  //A small ring so producers also go through the full ring backpressure.
+  QueuedOrderCache qoc{64, 16};
+  vector<thread> producers{};
+  for (int t = 0; t < 4; ++t)
+  {
+    producers.emplace_back([&qoc, t]
+    {
+      for (int i = 0; i < 1000; ++i)
+      {
+        qoc.addOrder(Order("OrdId" + to_string(t) + "-" + to_string(i), "SecIdX", "Buy", 100, "User" + to_string(t), "Company1"));
+      }
+      qoc.cancelOrdersForUser("User" + to_string(t % 2));
+    });
+  }
+  for (auto& th : producers) th.join();
+
+  vector<future<void>> done{};
+  for (auto& o : matchTestOs) done.push_back(qoc.addOrderAsync(o));
+  for (auto& f : done) f.get();
+
+  auto allOrders = qoc.getAllOrders();
+  if (allOrders.size() != 2000 + matchTestOs.size() || qoc.getMatchingSizeForSecurity("SecId2") != 2700)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" bad queued cache state: "} << allOrders.size() << endl;
+    return false;
+  }
+
+  //An idle writer parks instead of burning a core, and wakes up for the next command.
+  auto cpu0 = std::clock();
+  this_thread::sleep_for(chrono::milliseconds(300));
+  auto idleCpuMs = 1000.0 * static_cast<double>(std::clock() - cpu0) / CLOCKS_PER_SEC;
+  qoc.cancelOrder("OrdId4");
+  if (idleCpuMs > 100 || qoc.getMatchingSizeForSecurity("SecId2") != 2100)
+  {
+    cout << string{__FILE__} + string{": "} << __LINE__ << std::string{" idle writer: "} << idleCpuMs << " ms cpu" << endl;
+    return false;
+  }
+  return true;
+}
+
 int main ()
 {
   vector<Order> os
@@ -223,8 +1229,21 @@ int main ()
 
   cout << (AddOrderTest(os) ? "[OK]" : "[FAILED]") << " addOrder()" << endl;
   cout << (CancelOrderTest(os) ? "[OK]" : "[FAILED]") << " cancelOrder()" << endl;
+  cout << (AddCancelChurnTest() ? "[OK]" : "[FAILED]") << " addOrder()/cancelOrder() churn" << endl;
+  cout << (AddOrdersCancelOrdersTest(os) ? "[OK]" : "[FAILED]") << " addOrders()/cancelOrders()" << endl;
+  cout << (EmplaceOrderTest() ? "[OK]" : "[FAILED]") << " emplaceOrder()" << endl;
+  cout << (ForEachOrderTest(os) ? "[OK]" : "[FAILED]") << " forEachOrder()/viewOrders()" << endl;
+  cout << (SnapshotSaveLoadTest(os) ? "[OK]" : "[FAILED]") << " OrderCacheSnapshot save()/load()" << endl;
+  cout << (JournalRecoveryTest(os) ? "[OK]" : "[FAILED]") << " JournaledOrderCache recovery" << endl;
+  cout << (WorkloadTest() ? "[OK]" : "[FAILED]") << " WorkloadGenerator" << endl;
+  cout << (LoadOrdersJsonTest(os) ? "[OK]" : "[FAILED]") << " loadOrdersJson()" << endl;
+  cout << (ColumnarExportImportTest(os) ? "[OK]" : "[FAILED]") << " OrderCacheColumnar CBOR/MessagePack" << endl;
+  cout << (LatencyStatsTest(os) ? "[OK]" : "[FAILED]") << " stats() latency histograms" << endl;
+  cout << (MemoryUsageTest(os) ? "[OK]" : "[FAILED]") << " memoryUsage()" << endl;
+  cout << (SteadyStateAllocationTest() ? "[OK]" : "[FAILED]") << " addOrder()/cancelOrder() steady state allocations" << endl;
   cout << (CancelOrderForUserTest(os) ? "[OK]" : "[FAILED]") << " cancelOrderForUser()" << endl;
   cout << (CancelOrdersForSecIdWithMinimumQtyTest(os) ? "[OK]" : "[FAILED]") << " cancelOrderForSecIdWithMinimumQty()" << endl;
+  cout << (CancelOrdersForSecIdWithMinimumQtyChurnTest() ? "[OK]" : "[FAILED]") << " cancelOrderForSecIdWithMinimumQty() churn" << endl;
 
 
   //According to what's explained the match size for SecId2 is 2700...
@@ -246,6 +1265,11 @@ int main ()
 
   cout << (GetMatchingSizeForSecurityTest(matchTestOs0, "SecId1", 0) ? "[OK]" : "[FAILED]") << " getMatchingSizeForSecurity(SecId1, 0)" << endl;
 
+  cout << (GetMatchingSizeAfterCancelTest(matchTestOs0, "SecId2") ? "[OK]" : "[FAILED]") << " getMatchingSizeForSecurity() after cancels" << endl;
+  cout << (StringViewLookupTest(matchTestOs0) ? "[OK]" : "[FAILED]") << " string_view lookups and cancels" << endl;
+
+  cout << (QueuedOrderCacheTest(matchTestOs0) ? "[OK]" : "[FAILED]") << " QueuedOrderCache" << endl;
+
   vector<Order> matchTestOs1
   {
 
@@ -270,6 +1294,11 @@ int main ()
 
   cout << (GetMatchingSizeForSecurityTest(matchTestOs1, "SecId3", 600) ? "[OK]" : "[FAILED]") << " getMatchingSizeForSecurity(SecId3, 600)" << endl;
 
+  cout << (GetMatchingSizeForAllSecuritiesTest(matchTestOs1) ? "[OK]" : "[FAILED]") << " getMatchingSizeForAllSecurities()" << endl;
+
+  cout << (ShardedOrderCacheTest(matchTestOs1) ? "[OK]" : "[FAILED]") << " ShardedOrderCache" << endl;
+  cout << (SnapshotOrderCacheTest() ? "[OK]" : "[FAILED]") << " SnapshotOrderCache" << endl;
+
 
   vector<Order> matchTestOs2
   {
@@ -290,5 +1319,19 @@ int main ()
 
   cout << (GetMatchingSizeForSecurityTest(matchTestOs2, "SecId3", 0) ? "[OK]" : "[FAILED]") << " getMatchingSizeForSecurity(SecId3, 0)" << endl;
 
+
+  //Walking the pairs greedily, OrdId1/OrdId2 use up the only sell OrdId3 can match against (600 instead of 1100).
+  vector<Order> matchTestOs3
+  {
+    {"OrdId1", "SecId1", "Buy",  500, "User1", "CompanyC"},
+    {"OrdId2", "SecId1", "Sell", 600, "User2", "CompanyD"},
+    {"OrdId3", "SecId1", "Buy",  600, "User3", "CompanyB"},
+    {"OrdId4", "SecId1", "Sell", 500, "User4", "CompanyB"}
+  };
+
+  cout << (GetMatchingSizeForSecurityTest(matchTestOs3, "SecId1", 1100) ? "[OK]" : "[FAILED]") << " getMatchingSizeForSecurity(SecId1, 1100)" << endl;
+
+  cout << (MatchingEngineMaxFlowTest() ? "[OK]" : "[FAILED]") << " MatchingEngine::solve() against max flow" << endl;
+
   return 0;
 }
\ No newline at end of file
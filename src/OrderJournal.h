@@ -0,0 +1,356 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <filesystem>
+#include "OrderCache.h"
+#include "MappedFile.h"
+#include "OrderCacheSnapshot.h"
+
+//Group commit knobs: a group is written with one write() and made durable with one fsync.
+struct JournalOptions
+{
+  size_t groupEntries{256};
+  size_t groupBytes{1 << 20};
+  bool fsync{true};
+};
+
+//What a replay found: the last sequence applied and where the good part of the journal ends.
+struct JournalTail
+{
+  uint64_t lastSequence{0};
+  uint64_t validBytes{0};
+  size_t applied{0};
+};
+
+//What JournaledOrderCache construction recovered. When ok is false the book is left empty and mutations are refused.
+struct JournalRecovery : JournalTail
+{
+  bool ok{true};
+  string error{};
+};
+
+/* Entry codec of the journal, shared with the formats built on its framing (OrderWorkload.h).
+Each entry is [length u32][op u8][sequence u64][fields][checksum u32], strings as [length u32][bytes].
+The codec decodes the fields of the journal's own ops, the cache mutations; a format that adds
+ops of its own hands read() a fields reader that decodes them. */
+class JournalCodec
+{
+  template <typename T>
+  static void put(string& out, const T& v) { out.append(reinterpret_cast<const char*>(&v), sizeof(T)); }
+  static void put(string& out, string_view s)
+  {
+    put(out, static_cast<uint32_t>(s.size()));
+    out.append(s.data(), s.size());
+  }
+
+public:
+  enum class Op : uint8_t { Add = 1, Cancel, CancelUser, CancelSecMinQty };
+
+  //One decoded entry, the strings are views into the file. Fields the op doesn't carry are empty.
+  struct Entry
+  {
+    Op op{};
+    uint64_t sequence{0};
+    string_view orderId{}, securityId{}, side{}, user{}, company{};
+    uint32_t qty{0};
+  };
+
+  static uint32_t checksum(const char* p, size_t n)
+  {
+    //FNV-1a, enough to tell a torn write from a whole entry.
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) h = (h ^ static_cast<uint8_t>(p[i])) * 16777619u;
+    return h;
+  }
+  //Purpose: append one whole entry to out.
+  template <typename... Fields>
+  static void append(string& out, Op op, uint64_t sequence, const Fields&... fields)
+  {
+    auto start = out.size();
+    put(out, uint32_t{0});
+    put(out, op);
+    put(out, sequence);
+    (put(out, fields), ...);
+    auto length = static_cast<uint32_t>(out.size() - start - sizeof(uint32_t));
+    memcpy(&out[start], &length, sizeof(length));
+    put(out, checksum(out.data() + start + sizeof(uint32_t), length));
+  }
+  static bool get(ByteReader& in, string_view& s)
+  {
+    uint32_t length{};
+    if (!in.read(length)) return false;
+    auto at = in.take<char>(length);
+    if (!at) return false;
+    s = string_view{at, length};
+    return true;
+  }
+  //Purpose: decode the fields of a mutation entry. False for a short entry or an op that is not a mutation.
+  static bool mutationFields(ByteReader& in, Entry& e)
+  {
+    switch (e.op)
+    {
+      case Op::Add:
+        return get(in, e.orderId) && get(in, e.securityId) && get(in, e.side) && in.read(e.qty) && get(in, e.user) && get(in, e.company);
+      case Op::Cancel:
+        return get(in, e.orderId);
+      case Op::CancelUser:
+        return get(in, e.user);
+      case Op::CancelSecMinQty:
+        return get(in, e.securityId) && in.read(e.qty);
+    }
+    return false;
+  }
+
+  /* Decode the entries of the file at path, handing those with a sequence above afterSequence to
+  visit(const Entry&) in order, their fields decoded by fields(ByteReader&, Entry&). A missing
+  file is an empty one; decoding stops at the first torn or corrupt entry, or one fields()
+  turns down. The fields are views into the mapped file: no Order is built. */
+  template <typename FieldsReader, typename Visitor>
+  static JournalTail read(const string& path, uint64_t afterSequence, FieldsReader&& fields, Visitor&& visit)
+  {
+    JournalTail tail{};
+    tail.lastSequence = afterSequence;
+    MappedFile file{path};
+    if (!file.ok()) return tail;
+
+    ByteReader in{file.data(), file.data() + file.size()};
+    while (in.p != in.end)
+    {
+      uint32_t length{}, sum{};
+      if (!in.read(length)) break;
+      auto body = in.take<char>(length);
+      if (!body || !in.read(sum) || checksum(body, length) != sum) break;
+
+      ByteReader entry{body, body + length};
+      Entry e{};
+      if (!entry.read(e.op) || !entry.read(e.sequence) || !fields(entry, e)) break;
+
+      if (e.sequence > afterSequence)
+      {
+        visit(static_cast<const Entry&>(e));
+        ++tail.applied;
+      }
+      tail.lastSequence = max(tail.lastSequence, e.sequence);
+      tail.validBytes = static_cast<uint64_t>(in.p - file.data());
+    }
+    return tail;
+  }
+  //Purpose: apply a mutation entry to oc.
+  static void apply(OrderCache& oc, const Entry& e)
+  {
+    switch (e.op)
+    {
+      case Op::Add:
+        oc.emplaceOrder(e.orderId, e.securityId, e.side, e.qty, e.user, e.company);
+        break;
+      case Op::Cancel:
+        oc.cancelOrder(e.orderId);
+        break;
+      case Op::CancelUser:
+        oc.cancelOrdersForUser(e.user);
+        break;
+      case Op::CancelSecMinQty:
+        oc.cancelOrdersForSecIdWithMinimumQty(e.securityId, e.qty);
+        break;
+    }
+  }
+};
+
+/* Append only binary journal of cache mutations (write ahead log), entries as in JournalCodec.
+The bulk cancels are one entry each, however many orders they remove: replaying them against
+the same book removes the same orders. Entries are buffered and written by groups (group commit),
+each group followed by an fsync when options.fsync is set, so durability costs one fsync per
+group instead of one per mutation; flush() closes a group early. An entry is only durable once
+its group has been flushed. Replay stops at the first torn or corrupt entry: that is where the
+process died during a write. Not thread safe, it sits next to the cache's single writer. */
+class OrderJournal
+{
+public:
+  using Op = JournalCodec::Op;
+  using Entry = JournalCodec::Entry;
+
+private:
+  string path;
+  JournalOptions options;
+  FILE* file{nullptr};
+  string group{};
+  size_t groupSize{0};
+  uint64_t sequence{0};
+  bool failed{false};
+
+  template <typename... Fields>
+  void append(Op op, const Fields&... fields)
+  {
+    JournalCodec::append(group, op, ++sequence, fields...);
+    if (++groupSize >= options.groupEntries || group.size() >= options.groupBytes) flush();
+  }
+
+public:
+  //Opens (or creates) the journal at path for appending, call resume() first when it has entries.
+  explicit OrderJournal(string journalPath, JournalOptions journalOptions = {})
+    : path(std::move(journalPath)), options(journalOptions)
+  {
+    file = fopen(path.c_str(), "ab");
+    failed = file == nullptr;
+  }
+  ~OrderJournal()
+  {
+    flush();
+    if (file) fclose(file);
+  }
+  OrderJournal(const OrderJournal&) = delete;
+  OrderJournal& operator=(const OrderJournal&) = delete;
+
+  //Purpose: continue after a replay: a torn tail is cut off and the sequence carries on.
+  void resume(const JournalTail& tail)
+  {
+    flush();
+    sequence = max(sequence, tail.lastSequence);
+    if (!file) return;
+    std::error_code ec{};
+    auto size = filesystem::file_size(path, ec);
+    if (!ec && size != tail.validBytes)
+    {
+      fclose(file);
+      filesystem::resize_file(path, tail.validBytes, ec);
+      file = fopen(path.c_str(), "ab");
+    }
+    failed = failed || ec || file == nullptr;
+  }
+  //Purpose: empty the journal, for after a snapshot holding everything up to sequence() was written.
+  void truncate()
+  {
+    flush();
+    if (file) fclose(file);
+    file = fopen(path.c_str(), "wb");
+    failed = failed || file == nullptr;
+    if (options.fsync && file) failed = failed || !syncFile(file);
+  }
+
+  void addOrder(string_view orderId, string_view securityId, string_view side, unsigned int qty, string_view user, string_view company)
+  {
+    append(Op::Add, orderId, securityId, side, uint32_t{qty}, user, company);
+  }
+  void cancelOrder(string_view orderId) { append(Op::Cancel, orderId); }
+  void cancelOrdersForUser(string_view user) { append(Op::CancelUser, user); }
+  void cancelOrdersForSecIdWithMinimumQty(string_view securityId, unsigned int minQty)
+  {
+    append(Op::CancelSecMinQty, securityId, uint32_t{minQty});
+  }
+
+  //Purpose: write the pending group and fsync it (when enabled). False once any write has failed.
+  bool flush()
+  {
+    if (group.empty() || !file) return !failed;
+    failed = failed || fwrite(group.data(), 1, group.size(), file) != group.size() || fflush(file) != 0;
+    //Where no write can be made durable, an fsync asked for is a failure, not a silent no-op.
+    if (options.fsync) failed = failed || !syncFile(file);
+    group.clear();
+    groupSize = 0;
+    return !failed;
+  }
+  bool good() const { return !failed; }
+  uint64_t lastSequence() const { return sequence; }
+
+  //Purpose: decode the entries of the journal at path with a sequence above afterSequence, see JournalCodec::read().
+  template <typename Visitor>
+  static JournalTail read(const string& journalPath, uint64_t afterSequence, Visitor&& visit)
+  {
+    return JournalCodec::read(journalPath, afterSequence, JournalCodec::mutationFields, visit);
+  }
+  //Purpose: replay the entries of the journal at path with a sequence above afterSequence into oc.
+  static JournalTail replay(OrderCache& oc, const string& journalPath, uint64_t afterSequence = 0)
+  {
+    return read(journalPath, afterSequence, [&](const Entry& e) { JournalCodec::apply(oc, e); });
+  }
+};
+
+/* OrderCache made durable by a snapshot plus a journal.
+Construction recovers the book: the snapshot (when there is one) then the journal entries
+written after it. Every mutation is journaled before it is applied; checkpoint() writes a new
+snapshot and empties the journal. Reads go to cache().
+A snapshot that is there but can't be loaded, or a journal that can't be opened, fails the
+recovery (see recovery()): the book stays empty and every mutation is ignored, since after a
+checkpoint the journal alone would give back part of the book. */
+class JournaledOrderCache : public OrderCacheInterface
+{
+  OrderCache book;
+  string snapshotPath;
+  string journalPath;
+  OrderJournal journal;
+  JournalRecovery recovered{};
+
+public:
+  JournaledOrderCache(string snapshotFile, string journalFile, JournalOptions options = {}, pmr::memory_resource* resource = pmr::get_default_resource())
+    : book(resource), snapshotPath(std::move(snapshotFile)), journalPath(std::move(journalFile)), journal(journalPath, options)
+  {
+    if (!journal.good())
+    {
+      recovered.ok = false;
+      recovered.error = "cannot open journal " + journalPath;
+      return;
+    }
+    //Only a missing snapshot means starting from the journal alone.
+    uint64_t snapshotSequence{0};
+    std::error_code ec{};
+    auto hasSnapshot = filesystem::exists(snapshotPath, ec);
+    if (ec || (hasSnapshot && !OrderCacheSnapshot::load(book, snapshotPath, &snapshotSequence)))
+    {
+      recovered.ok = false;
+      recovered.error = "cannot load snapshot " + snapshotPath;
+      return;
+    }
+    static_cast<JournalTail&>(recovered) = OrderJournal::replay(book, journalPath, snapshotSequence);
+    journal.resume(recovered);
+  }
+
+  const OrderCache& cache() const { return book; }
+  const OrderJournal& log() const { return journal; }
+  //Purpose: what construction replayed from the journal, and whether the recovery succeeded.
+  const JournalRecovery& recovery() const { return recovered; }
+
+  void addOrder(Order o) override
+  {
+    if (!recovered.ok || book.hasOrder(o.orderIdRef())) return;
+    journal.addOrder(o.orderIdRef(), o.securityIdRef(), o.sideRef(), o.qty(), o.userRef(), o.companyRef());
+    book.addOrder(std::move(o));
+  }
+  void cancelOrder(const std::string& orderId) override
+  {
+    if (!recovered.ok || !book.hasOrder(orderId)) return;
+    journal.cancelOrder(orderId);
+    book.cancelOrder(orderId);
+  }
+  void cancelOrdersForUser(const std::string& user) override
+  {
+    if (!recovered.ok) return;
+    journal.cancelOrdersForUser(user);
+    book.cancelOrdersForUser(user);
+  }
+  void cancelOrdersForSecIdWithMinimumQty(const std::string& securityId, unsigned int minQty) override
+  {
+    if (!recovered.ok) return;
+    journal.cancelOrdersForSecIdWithMinimumQty(securityId, minQty);
+    book.cancelOrdersForSecIdWithMinimumQty(securityId, minQty);
+  }
+  unsigned int getMatchingSizeForSecurity(const std::string& securityId) override
+  {
+    return book.getMatchingSizeForSecurity(securityId);
+  }
+  vector<Order> getAllOrders() const override
+  {
+    return book.getAllOrders();
+  }
+
+  //Purpose: make every mutation so far durable now, without waiting for the group to fill.
+  bool flush() { return journal.flush(); }
+  /* Purpose: snapshot the book and empty the journal. The journal is only emptied once save() has
+  made the snapshot durable, so a crash in between leaves the new snapshot and a journal it
+  already holds: the snapshot records the last sequence and replay skips up to it. */
+  bool checkpoint()
+  {
+    if (!recovered.ok || !journal.flush() || !OrderCacheSnapshot::save(book, snapshotPath, journal.lastSequence())) return false;
+    journal.truncate();
+    return journal.good();
+  }
+};
@@ -0,0 +1,289 @@
+#pragma once
+#include <cmath>
+#include <cctype>
+#include <cerrno>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "OrderJournal.h"
+
+/* Knobs of a synthetic workload. The same options (seed included) always give the same stream
+with a given standard library (the std distributions are not specified bit for bit).
+The mix weights are relative, they need not add up to 1. */
+struct WorkloadOptions
+{
+  uint64_t seed{42};
+  unsigned int operations{1000000};
+  //Security of rank k (SecId0 is the hottest) is picked with a probability proportional to 1/k^zipf.
+  unsigned int securities{10000};
+  double zipf{1.1};
+  //Users are uniform but come in bursts: a user sends burstLength orders in a row on average.
+  unsigned int users{20000};
+  double burstLength{8};
+  unsigned int companies{500};
+  //Order sizes are log-normal around qtyMedian, rounded to lots of qtyLot and capped at qtyMax.
+  unsigned int qtyMedian{1000};
+  double qtySigma{1.0};
+  unsigned int qtyLot{100};
+  unsigned int qtyMax{1000000};
+  double addWeight{0.5};
+  double cancelWeight{0.3};
+  double cancelUserWeight{0.005};
+  double cancelSecMinQtyWeight{0.005};
+  double matchWeight{0.19};
+
+  //Purpose: set a knob from "name=value", false for an unknown name or a value out of the knob's range.
+  bool set(const string& setting)
+  {
+    auto eq = setting.find('=');
+    if (eq == string::npos) return false;
+    auto name = setting.substr(0, eq);
+    char* end{nullptr};
+    auto text = setting.c_str() + eq + 1;
+
+    //Counts take whole numbers that fit the knob: nothing is rounded or narrowed.
+    auto count = [&](auto& knob, unsigned long long least = 0)
+    {
+      using Knob = std::remove_reference_t<decltype(knob)>;
+      if (!isdigit(static_cast<unsigned char>(*text))) return false;
+      errno = 0;
+      auto value = strtoull(text, &end, 10);
+      if (*end != '\0' || errno == ERANGE || value < least || value > std::numeric_limits<Knob>::max()) return false;
+      knob = static_cast<Knob>(value);
+      return true;
+    };
+    auto real = [&](double& knob, double least = 0)
+    {
+      errno = 0;
+      auto value = strtod(text, &end);
+      if (end == text || *end != '\0' || errno == ERANGE || !std::isfinite(value) || value < least) return false;
+      knob = value;
+      return true;
+    };
+    if (name == "seed") return count(seed);
+    if (name == "operations") return count(operations);
+    if (name == "securities") return count(securities, 1);
+    if (name == "zipf") return real(zipf);
+    if (name == "users") return count(users, 1);
+    if (name == "burst") return real(burstLength, 1);
+    if (name == "companies") return count(companies, 1);
+    if (name == "qtyMedian") return count(qtyMedian);
+    if (name == "qtySigma") return real(qtySigma);
+    if (name == "qtyLot") return count(qtyLot, 1);
+    if (name == "qtyMax") return count(qtyMax, 1);
+    if (name == "add") return real(addWeight);
+    if (name == "cancel") return real(cancelWeight);
+    if (name == "cancelUser") return real(cancelUserWeight);
+    if (name == "cancelSecMinQty") return real(cancelSecMinQtyWeight);
+    if (name == "match") return real(matchWeight);
+    return false;
+  }
+  //Purpose: false when the mix has nothing to draw from: no weight above 0, or weights adding up past a double.
+  bool valid() const
+  {
+    auto total = addWeight + cancelWeight + cancelUserWeight + cancelSecMinQtyWeight + matchWeight;
+    return std::isfinite(total) && total > 0;
+  }
+};
+
+/* Workload file: the journal's entries (JournalCodec) plus Match entries, each a call of
+getMatchingSizeForSecurity. A Match is a read, so it has no place in the journal itself: an
+OrderJournal reader stops at the first one. Read a workload with WorkloadFile::read(). */
+struct WorkloadFile
+{
+  static constexpr JournalCodec::Op Match = static_cast<JournalCodec::Op>(5);
+
+  //Purpose: decode the entries of the workload at path, handing them to visit(const JournalCodec::Entry&) in order.
+  template <typename Visitor>
+  static JournalTail read(const string& path, Visitor&& visit)
+  {
+    auto fields = [](ByteReader& in, JournalCodec::Entry& e) { return e.op == Match ? JournalCodec::get(in, e.securityId) : JournalCodec::mutationFields(in, e); };
+    return JournalCodec::read(path, 0, fields, visit);
+  }
+  //Purpose: apply an entry to oc, returns the matching size of a Match and 0 for a mutation.
+  static unsigned int apply(OrderCache& oc, const JournalCodec::Entry& e)
+  {
+    if (e.op == Match) return oc.getMatchingSizeForSecurity(e.securityId);
+    JournalCodec::apply(oc, e);
+    return 0;
+  }
+  //Purpose: replay the mutations of the workload at path into oc, the matches are skipped.
+  static JournalTail replay(OrderCache& oc, const string& path)
+  {
+    return read(path, [&](const JournalCodec::Entry& e) { if (e.op != Match) JournalCodec::apply(oc, e); });
+  }
+};
+
+/* Writes a workload file. Entries are buffered and written a megabyte at a time, with no fsync:
+a workload is regenerated from its options, never recovered. */
+class WorkloadWriter
+{
+  FILE* file{nullptr};
+  string buffer{};
+  uint64_t sequence{0};
+  bool failed{false};
+
+  template <typename... Fields>
+  void append(JournalCodec::Op op, const Fields&... fields)
+  {
+    JournalCodec::append(buffer, op, ++sequence, fields...);
+    if (buffer.size() >= (1u << 20)) flush();
+  }
+
+public:
+  //Creates (or empties) the workload at path.
+  explicit WorkloadWriter(const string& path)
+  {
+    file = fopen(path.c_str(), "wb");
+    failed = file == nullptr;
+  }
+  ~WorkloadWriter()
+  {
+    flush();
+    if (file) fclose(file);
+  }
+  WorkloadWriter(const WorkloadWriter&) = delete;
+  WorkloadWriter& operator=(const WorkloadWriter&) = delete;
+
+  void addOrder(string_view orderId, string_view securityId, string_view side, unsigned int qty, string_view user, string_view company)
+  {
+    append(JournalCodec::Op::Add, orderId, securityId, side, static_cast<uint32_t>(qty), user, company);
+  }
+  void cancelOrder(string_view orderId) { append(JournalCodec::Op::Cancel, orderId); }
+  void cancelOrdersForUser(string_view user) { append(JournalCodec::Op::CancelUser, user); }
+  void cancelOrdersForSecIdWithMinimumQty(string_view securityId, unsigned int minQty)
+  {
+    append(JournalCodec::Op::CancelSecMinQty, securityId, static_cast<uint32_t>(minQty));
+  }
+  void getMatchingSizeForSecurity(string_view securityId) { append(WorkloadFile::Match, securityId); }
+
+  //Purpose: write out the buffered entries, false once any write failed.
+  bool flush()
+  {
+    if (!buffer.empty() && file) failed = failed || fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size();
+    buffer.clear();
+    if (file) failed = failed || fflush(file) != 0;
+    return !failed;
+  }
+};
+
+/* Seeded stream of cache operations with the skew of a real book: Zipf distributed securities,
+bursty users (each trading for one company), log-normal order sizes and a configurable mix of
+adds, cancels, bulk cancels and matches. The generator keeps the ids of the orders it added and
+not yet cancelled by id, and cancels one of those at random. It does not model the bulk cancels,
+so a few cancels target orders they already removed: the cache ignores those, as it would a late
+cancel. When nothing is left to cancel, a cancel is an add. The options must be valid(). */
+class WorkloadGenerator
+{
+  WorkloadOptions options;
+  std::mt19937_64 rng;
+  vector<double> securityCdf{};
+  std::lognormal_distribution<double> qtyDistribution;
+  std::discrete_distribution<int> opDistribution;
+  std::geometric_distribution<unsigned int> burstDistribution;
+  vector<uint64_t> open{};
+  uint64_t nextOrderId{0};
+  unsigned int burstUser{0};
+  unsigned int burstLeft{0};
+  string orderId{}, securityId{}, user{}, company{};
+
+  unsigned int uniform(unsigned int n) { return static_cast<unsigned int>(rng() % n); }
+  unsigned int security()
+  {
+    auto u = std::uniform_real_distribution<double>{0, securityCdf.back()}(rng);
+    auto rank = std::upper_bound(securityCdf.begin(), securityCdf.end(), u) - securityCdf.begin();
+    return static_cast<unsigned int>(std::min<ptrdiff_t>(rank, securityCdf.size() - 1));
+  }
+  unsigned int nextUser()
+  {
+    if (burstLeft == 0)
+    {
+      burstUser = uniform(options.users);
+      burstLeft = burstDistribution(rng) + 1;
+    }
+    --burstLeft;
+    return burstUser;
+  }
+  unsigned int qty()
+  {
+    auto lots = std::llround(qtyDistribution(rng) / options.qtyLot);
+    auto q = static_cast<unsigned long long>(std::max(1ll, static_cast<long long>(lots))) * options.qtyLot;
+    return static_cast<unsigned int>(std::min<unsigned long long>(q, options.qtyMax));
+  }
+  const string& name(string& out, const char* prefix, uint64_t n)
+  {
+    out = prefix;
+    out += to_string(n);
+    return out;
+  }
+
+public:
+  explicit WorkloadGenerator(const WorkloadOptions& workloadOptions)
+    : options(workloadOptions), rng(workloadOptions.seed),
+      qtyDistribution(std::log(std::max(1u, workloadOptions.qtyMedian)), workloadOptions.qtySigma),
+      opDistribution({workloadOptions.addWeight, workloadOptions.cancelWeight, workloadOptions.cancelUserWeight,
+        workloadOptions.cancelSecMinQtyWeight, workloadOptions.matchWeight}),
+      burstDistribution(1.0 / std::max(1.0, workloadOptions.burstLength))
+  {
+    options.securities = std::max(1u, options.securities);
+    options.users = std::max(1u, options.users);
+    options.companies = std::max(1u, options.companies);
+    options.qtyLot = std::max(1u, options.qtyLot);
+    securityCdf.reserve(options.securities);
+    double total{0};
+    for (unsigned int k = 1; k <= options.securities; ++k) securityCdf.push_back(total += 1.0 / std::pow(k, options.zipf));
+  }
+
+  //Purpose: write the next operation to out.
+  void next(WorkloadWriter& out)
+  {
+    auto op = static_cast<JournalCodec::Op>(opDistribution(rng) + 1);
+    if (op == JournalCodec::Op::Cancel && open.empty()) op = JournalCodec::Op::Add;
+    if (op == WorkloadFile::Match)
+    {
+      out.getMatchingSizeForSecurity(name(securityId, "SecId", security()));
+      return;
+    }
+    switch (op)
+    {
+      case JournalCodec::Op::Add:
+      {
+        auto u = nextUser();
+        //Users map to companies through a scramble, so neighbouring users work for different companies.
+        auto c = static_cast<unsigned int>(u * 2654435761ull % options.companies);
+        open.push_back(nextOrderId);
+        out.addOrder(name(orderId, "OrdId", nextOrderId++), name(securityId, "SecId", security()), rng() % 2 ? "Buy" : "Sell", qty(),
+          name(user, "User", u), name(company, "Company", c));
+        break;
+      }
+      case JournalCodec::Op::Cancel:
+      {
+        auto i = uniform(static_cast<unsigned int>(std::min<size_t>(open.size(), ~0u)));
+        swap(open[i], open.back());
+        out.cancelOrder(name(orderId, "OrdId", open.back()));
+        open.pop_back();
+        break;
+      }
+      case JournalCodec::Op::CancelUser:
+        out.cancelOrdersForUser(name(user, "User", nextUser()));
+        break;
+      case JournalCodec::Op::CancelSecMinQty:
+        out.cancelOrdersForSecIdWithMinimumQty(name(securityId, "SecId", security()), qty());
+        break;
+    }
+  }
+};
+
+/* Purpose: write a workload of options.operations operations to path: it can be replayed into a
+cache with WorkloadFile::replay(), or timed entry by entry with WorkloadFile::read() and apply().
+False when the options are not valid() (nothing is written) or the file can't be written. */
+inline bool writeWorkload(const WorkloadOptions& options, const string& path)
+{
+  if (!options.valid()) return false;
+  WorkloadWriter out{path};
+  WorkloadGenerator generator{options};
+  for (unsigned int i = 0; i < options.operations; ++i) generator.next(out);
+  return out.flush();
+}
@@ -0,0 +1,40 @@
+#include "OrderWorkload.h"
+
+/* Writes a synthetic workload (see WorkloadGenerator) to a workload file, for the benchmark to
+replay, or WorkloadFile::replay() to load. Knobs are given as name=value:
+seed operations securities zipf users burst companies qtyMedian qtySigma qtyLot qtyMax
+add cancel cancelUser cancelSecMinQty match (the last five are the mix weights). */
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    cerr << "usage: " << argv[0] << " file [name=value ...]" << endl;
+    return 1;
+  }
+  WorkloadOptions options{};
+  for (int i = 2; i < argc; ++i)
+  {
+    if (!options.set(argv[i]))
+    {
+      cerr << "bad setting: " << argv[i] << endl;
+      return 1;
+    }
+  }
+  if (!options.valid())
+  {
+    cerr << "the mix weights add up to nothing" << endl;
+    return 1;
+  }
+  if (!writeWorkload(options, argv[1]))
+  {
+    cerr << "cannot write " << argv[1] << endl;
+    return 1;
+  }
+
+  //Tally what was written.
+  size_t counts[5]{};
+  WorkloadFile::read(argv[1], [&](const JournalCodec::Entry& e) { ++counts[static_cast<int>(e.op) - 1]; });
+  cout << argv[1] << ": " << options.operations << " operations, " << counts[0] << " addOrder, " << counts[1] << " cancelOrder, "
+       << counts[2] << " cancelOrdersForUser, " << counts[3] << " cancelOrdersForSecIdWithMinimumQty, " << counts[4] << " getMatchingSizeForSecurity" << endl;
+  return 0;
+}
@@ -0,0 +1,259 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include "OrderCache.h"
+
+/* Bounded lock free multi producer / single consumer ring (Vyukov's bounded queue).
+Every cell carries a sequence number telling whose turn it is: producers claim a position with a
+CAS on head and publish the cell by bumping its sequence, the single consumer reads cells in
+order and hands them back to producers one lap later. A full ring makes tryPush() fail. */
+template <typename T>
+class MpscRing
+{
+  struct Cell
+  {
+    atomic<size_t> seq;
+    T value;
+  };
+
+  unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(64) atomic<size_t> head{0};
+  alignas(64) size_t tail{0};
+
+public:
+  //capacity is rounded up to a power of 2.
+  explicit MpscRing(size_t capacity)
+  {
+    size_t size = 2;
+    while (size < capacity) size *= 2;
+    cells.reset(new Cell[size]);
+    mask = size - 1;
+    for (size_t i = 0; i < size; ++i) cells[i].seq.store(i, memory_order_relaxed);
+  }
+
+  //Producer side, any thread.
+  bool tryPush(T&& value)
+  {
+    auto pos = head.load(memory_order_relaxed);
+    while (true)
+    {
+      auto& cell = cells[pos & mask];
+      auto seq = cell.seq.load(memory_order_acquire);
+      auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (dif == 0)
+      {
+        if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+        {
+          cell.value = std::move(value);
+          cell.seq.store(pos + 1, memory_order_release);
+          return true;
+        }
+      }
+      else if (dif < 0) return false;
+      else pos = head.load(memory_order_relaxed);
+    }
+  }
+  //Consumer side, one thread only: whether tryPop() would succeed.
+  bool readable() const
+  {
+    return cells[tail & mask].seq.load(memory_order_acquire) == tail + 1;
+  }
+  //Consumer side, one thread only.
+  bool tryPop(T& value)
+  {
+    auto& cell = cells[tail & mask];
+    if (cell.seq.load(memory_order_acquire) != tail + 1) return false;
+    value = std::move(cell.value);
+    cell.seq.store(tail + mask + 1, memory_order_release);
+    ++tail;
+    return true;
+  }
+};
+
+struct CacheCommand
+{
+  enum class Type : uint8_t { Add, Cancel, CancelUser, CancelSecMinQty, Match, AllOrders };
+
+  Type type{Type::Add};
+  Order order{};
+  string key{};
+  unsigned int qty{0};
+  unique_ptr<promise<void>> done{};
+  promise<unsigned int>* matched{nullptr};
+  promise<vector<Order>>* allOrders{nullptr};
+};
+
+/* Single writer OrderCacheInterface. Producer threads only enqueue commands in a bounded MPSC
+ring; one writer thread drains them in batches into a plain OrderCache, so the cache itself stays
+single threaded and hot in the writer's core cache. Mutations return as soon as the command is
+queued (the *Async variants give a future completed once the writer applied it); queries are
+queued too and wait for their answer, so they see every command queued before them.
+A full ring pushes back on producers, which spin until the writer frees a cell. An idle writer
+spins a little, then yields, then parks on a condition variable: producers only take its mutex
+to wake it when it announced it was parking, so a busy writer costs them nothing but a fence. */
+class QueuedOrderCache : public OrderCacheInterface
+{
+  OrderCache cache{};
+  mutable MpscRing<CacheCommand> ring;
+  size_t batchSize;
+  atomic<bool> stop{false};
+  mutable mutex parking{};
+  mutable condition_variable wakeup{};
+  mutable atomic<bool> parked{false};
+  thread writer;
+
+  void enqueue(CacheCommand&& command) const
+  {
+    while (!ring.tryPush(std::move(command))) this_thread::yield();
+    //Pairs with the fence in park(): either the writer sees the command or this sees it parked.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (parked.load(memory_order_relaxed))
+    {
+      lock_guard<mutex> lock{parking};
+      wakeup.notify_one();
+    }
+  }
+  void park()
+  {
+    unique_lock<mutex> lock{parking};
+    parked.store(true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    wakeup.wait(lock, [this] { return stop.load() || ring.readable(); });
+    parked.store(false, memory_order_relaxed);
+  }
+  void apply(CacheCommand& command)
+  {
+    switch (command.type)
+    {
+      case CacheCommand::Type::Add: cache.addOrder(std::move(command.order)); break;
+      case CacheCommand::Type::Cancel: cache.cancelOrder(command.key); break;
+      case CacheCommand::Type::CancelUser: cache.cancelOrdersForUser(command.key); break;
+      case CacheCommand::Type::CancelSecMinQty: cache.cancelOrdersForSecIdWithMinimumQty(command.key, command.qty); break;
+      case CacheCommand::Type::Match: command.matched->set_value(cache.getMatchingSizeForSecurity(command.key)); break;
+      case CacheCommand::Type::AllOrders: command.allOrders->set_value(cache.getAllOrders()); break;
+    }
+    if (command.done) command.done->set_value();
+    command.done.reset();
+  }
+  void writerLoop()
+  {
+    CacheCommand command{};
+    unsigned int idle{0};
+    while (true)
+    {
+      size_t drained = 0;
+      while (drained < batchSize && ring.tryPop(command))
+      {
+        apply(command);
+        ++drained;
+      }
+      if (drained) { idle = 0; continue; }
+      //Every command queued before the destructor ran gets applied: drain once more after stop.
+      if (stop.load())
+      {
+        while (ring.tryPop(command)) apply(command);
+        return;
+      }
+      //Spin for a burst that is about to arrive, yield for a while, then sleep until a producer wakes us.
+      if (++idle > 1024)
+      {
+        park();
+        idle = 0;
+      }
+      else if (idle > 64) this_thread::yield();
+    }
+  }
+  future<void> enqueueAsync(CacheCommand&& command)
+  {
+    command.done.reset(new promise<void>{});
+    auto f = command.done->get_future();
+    enqueue(std::move(command));
+    return f;
+  }
+
+public:
+  //Each cell holds a CacheCommand (an Order and a few strings), hence the modest default capacity.
+  explicit QueuedOrderCache(size_t capacity = 1 << 12, size_t batchSize = 256)
+    : ring(capacity), batchSize(max<size_t>(batchSize, 1)), writer([this]{ writerLoop(); }) {}
+  ~QueuedOrderCache()
+  {
+    {
+      lock_guard<mutex> lock{parking};
+      stop = true;
+    }
+    wakeup.notify_one();
+    writer.join();
+  }
+  QueuedOrderCache(const QueuedOrderCache&) = delete;
+  QueuedOrderCache& operator=(const QueuedOrderCache&) = delete;
+
+  void addOrder(Order o) override
+  {
+    CacheCommand command{};
+    command.order = std::move(o);
+    enqueue(std::move(command));
+  }
+  void cancelOrder(const std::string& orderId) override
+  {
+    CacheCommand command{};
+    command.type = CacheCommand::Type::Cancel;
+    command.key = orderId;
+    enqueue(std::move(command));
+  }
+  void cancelOrdersForUser(const std::string& user) override
+  {
+    CacheCommand command{};
+    command.type = CacheCommand::Type::CancelUser;
+    command.key = user;
+    enqueue(std::move(command));
+  }
+  void cancelOrdersForSecIdWithMinimumQty(const std::string& securityId, unsigned int minQty) override
+  {
+    CacheCommand command{};
+    command.type = CacheCommand::Type::CancelSecMinQty;
+    command.key = securityId;
+    command.qty = minQty;
+    enqueue(std::move(command));
+  }
+
+  future<void> addOrderAsync(Order o)
+  {
+    CacheCommand command{};
+    command.order = std::move(o);
+    return enqueueAsync(std::move(command));
+  }
+  future<void> cancelOrderAsync(const std::string& orderId)
+  {
+    CacheCommand command{};
+    command.type = CacheCommand::Type::Cancel;
+    command.key = orderId;
+    return enqueueAsync(std::move(command));
+  }
+
+  unsigned int getMatchingSizeForSecurity(const std::string& securityId) override
+  {
+    promise<unsigned int> matched{};
+    auto f = matched.get_future();
+    CacheCommand command{};
+    command.type = CacheCommand::Type::Match;
+    command.key = securityId;
+    command.matched = &matched;
+    enqueue(std::move(command));
+    return f.get();
+  }
+  vector<Order> getAllOrders() const override
+  {
+    promise<vector<Order>> allOrders{};
+    auto f = allOrders.get_future();
+    CacheCommand command{};
+    command.type = CacheCommand::Type::AllOrders;
+    command.allOrders = &allOrders;
+    enqueue(std::move(command));
+    return f.get();
+  }
+};
@@ -0,0 +1,157 @@
+#pragma once
+#include <mutex>
+#include <memory>
+#include <string_view>
+#include "OrderCache.h"
+
+/* Thread safe OrderCacheInterface: the book is split in shards by security id hash.
+Each shard is a plain OrderCache behind its own mutex, so threads working on different
+securities don't contend. An order id directory (striped, one mutex per stripe) tells which
+shard holds an order id: it rejects duplicate ids across shards and routes cancelOrder().
+Lock order is directory stripe -> shard; the bulk cancels, which lock shards first, only touch
+the directory after releasing the shard, and then only drop an entry once its shard is seen
+(under stripe -> shard) not to hold the order: the id may have been cancelled and re-added since.
+User wide cancels fan out over every shard. getAllOrders() and forEachOrder() visit the shards
+one after the other, so they do not give a point in time view of the whole book. */
+class ShardedOrderCache : public OrderCacheInterface
+{
+  struct Shard
+  {
+    mutable mutex m;
+    OrderCache cache;
+  };
+  struct DirectoryStripe
+  {
+    mutable mutex m;
+    unordered_map<string, size_t> shardOf;
+  };
+
+  vector<unique_ptr<Shard>> shards{};
+  vector<unique_ptr<DirectoryStripe>> directory{};
+
+  static size_t hashOf(string_view key) { return hash<string_view>{}(key); }
+
+  Shard& shardFor(const string& securityId) { return *shards[hashOf(securityId) % shards.size()]; }
+  DirectoryStripe& stripeFor(const string& orderId) { return *directory[hashOf(orderId) % directory.size()]; }
+
+  //Purpose: drop the directory entries of orders a shard has already cancelled, unless the id is live again.
+  void forget(const vector<string>& orderIds)
+  {
+    for (auto& orderId : orderIds)
+    {
+      auto& stripe = stripeFor(orderId);
+      lock_guard<mutex> stripeLock{stripe.m};
+      auto it = stripe.shardOf.find(orderId);
+      if (it == stripe.shardOf.end()) continue;
+
+      auto& shard = *shards[it->second];
+      lock_guard<mutex> shardLock{shard.m};
+      if (!shard.cache.hasOrder(orderId)) stripe.shardOf.erase(it);
+    }
+  }
+
+public:
+  explicit ShardedOrderCache(size_t nShards = 16, size_t nStripes = 64)
+  {
+    for (size_t i = 0; i < max<size_t>(nShards, 1); ++i) shards.emplace_back(new Shard{});
+    for (size_t i = 0; i < max<size_t>(nStripes, 1); ++i) directory.emplace_back(new DirectoryStripe{});
+  }
+
+  size_t shardCount() const { return shards.size(); }
+
+  void addOrder(Order o) override
+  {
+    auto& orderId = o.orderIdRef();
+    auto shardIndex = hashOf(o.securityIdRef()) % shards.size();
+
+    auto& stripe = stripeFor(orderId);
+    lock_guard<mutex> stripeLock{stripe.m};
+    if (!stripe.shardOf.emplace(orderId, shardIndex).second) return;
+
+    auto& shard = *shards[shardIndex];
+    lock_guard<mutex> shardLock{shard.m};
+    shard.cache.addOrder(std::move(o));
+  }
+  void cancelOrder(const std::string& orderId) override
+  {
+    auto& stripe = stripeFor(orderId);
+    lock_guard<mutex> stripeLock{stripe.m};
+    auto it = stripe.shardOf.find(orderId);
+    if (it == stripe.shardOf.end()) return;
+
+    auto& shard = *shards[it->second];
+    stripe.shardOf.erase(it);
+
+    lock_guard<mutex> shardLock{shard.m};
+    shard.cache.cancelOrder(orderId);
+  }
+  void cancelOrdersForUser(const std::string& user) override
+  {
+    vector<string> cancelledIds{};
+    for (auto& shard : shards)
+    {
+      {
+        lock_guard<mutex> shardLock{shard->m};
+        shard->cache.cancelOrdersForUser(user, &cancelledIds);
+      }
+      forget(cancelledIds);
+      cancelledIds.clear();
+    }
+  }
+  void cancelOrdersForSecIdWithMinimumQty(const std::string& securityId, unsigned int minQty) override
+  {
+    vector<string> cancelledIds{};
+    {
+      auto& shard = shardFor(securityId);
+      lock_guard<mutex> shardLock{shard.m};
+      shard.cache.cancelOrdersForSecIdWithMinimumQty(securityId, minQty, &cancelledIds);
+    }
+    forget(cancelledIds);
+  }
+  unsigned int getMatchingSizeForSecurity(const std::string& securityId) override
+  {
+    auto& shard = shardFor(securityId);
+    lock_guard<mutex> shardLock{shard.m};
+    return shard.cache.getMatchingSizeForSecurity(securityId);
+  }
+  vector<Order> getAllOrders() const override
+  {
+    vector<Order> allOrders{};
+    forEachOrder([&](const OrderView& o) { allOrders.push_back(o.toOrder()); });
+    return allOrders;
+  }
+  /* Visits the orders matching filter shard by shard, each under its shard lock (a security filter
+  only locks the shard of that security). The views are only valid inside the visitor. */
+  template <typename Visitor>
+  void forEachOrder(const OrderFilter& filter, Visitor&& visitor) const
+  {
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+      if (!filter.securityId.empty() && hashOf(filter.securityId) % shards.size() != i) continue;
+      lock_guard<mutex> shardLock{shards[i]->m};
+      shards[i]->cache.forEachOrder(filter, visitor);
+    }
+  }
+  template <typename Visitor>
+  void forEachOrder(Visitor&& visitor) const
+  {
+    forEachOrder(OrderFilter{}, visitor);
+  }
+
+  bool hasOrder(const string& orderId)
+  {
+    auto& stripe = stripeFor(orderId);
+    lock_guard<mutex> stripeLock{stripe.m};
+    return stripe.shardOf.count(orderId) != 0;
+  }
+  size_t size() const
+  {
+    size_t n{0};
+    for (auto& stripe : directory)
+    {
+      lock_guard<mutex> lock{stripe->m};
+      n += stripe->shardOf.size();
+    }
+    return n;
+  }
+};
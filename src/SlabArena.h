@@ -0,0 +1,86 @@
+#pragma once
+#include <new>
+#include <vector>
+#include <cstdint>
+#include <memory_resource>
+
+/* Slab storage with stable 32 bit handles.
+Elements live in fixed size slabs taken from a memory resource: a slab is never moved or given
+back while the arena lives, so a handle (and a reference to its element) stays valid until the
+element is released. Released handles go to a free list and are handed out again first, so a
+book with steady add/cancel traffic stops asking the resource for memory once it is warm.
+Every slot is constructed once, with the arena's memory resource, when its slab is created and
+destroyed with the arena; acquire() hands out a slot as is, the caller resets what it needs. */
+template <typename T, unsigned SlabBits = 12>
+class SlabArena
+{
+  static constexpr std::uint32_t slabSize = 1u << SlabBits;
+  static constexpr std::uint32_t slabMask = slabSize - 1;
+
+  std::pmr::memory_resource* resource;
+  std::pmr::memory_resource* element_resource;
+  std::pmr::vector<T*> slabs;
+  std::pmr::vector<std::uint32_t> free_handles;
+  std::uint32_t used{0};
+  size_t live{0};
+
+  void addSlab()
+  {
+    auto slab = static_cast<T*>(resource->allocate(sizeof(T) * slabSize, alignof(T)));
+    for (std::uint32_t i = 0; i < slabSize; ++i) new (slab + i) T(element_resource);
+    slabs.push_back(slab);
+  }
+
+public:
+  using Handle = std::uint32_t;
+  static constexpr Handle npos = ~Handle{0};
+
+  //Slabs come from r, the elements are constructed with elements (r when not given) for what they allocate.
+  explicit SlabArena(std::pmr::memory_resource* r = std::pmr::get_default_resource(), std::pmr::memory_resource* elements = nullptr)
+    : resource(r), element_resource(elements ? elements : r), slabs(r), free_handles(r) {}
+  ~SlabArena()
+  {
+    for (auto slab : slabs)
+    {
+      for (std::uint32_t i = 0; i < slabSize; ++i) slab[i].~T();
+      resource->deallocate(slab, sizeof(T) * slabSize, alignof(T));
+    }
+  }
+  SlabArena(const SlabArena&) = delete;
+  SlabArena& operator=(const SlabArena&) = delete;
+
+  Handle acquire()
+  {
+    ++live;
+    if (!free_handles.empty())
+    {
+      auto h = free_handles.back();
+      free_handles.pop_back();
+      return h;
+    }
+    if (used == slabs.size() * slabSize) addSlab();
+    return used++;
+  }
+  //Purpose: make room for n more elements now, so the next n acquire() calls don't allocate.
+  void reserve(size_t n)
+  {
+    auto capacity = slabs.size() * slabSize - used + free_handles.size();
+    while (capacity < n)
+    {
+      addSlab();
+      capacity += slabSize;
+    }
+  }
+  void release(Handle h)
+  {
+    --live;
+    free_handles.push_back(h);
+  }
+
+  T& operator[](Handle h) { return slabs[h >> SlabBits][h & slabMask]; }
+  const T& operator[](Handle h) const { return slabs[h >> SlabBits][h & slabMask]; }
+
+  //Handles ever handed out are [0, end()); released ones in there are the caller's to tell apart.
+  Handle end() const { return used; }
+  size_t size() const { return live; }
+};
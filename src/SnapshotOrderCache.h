@@ -0,0 +1,286 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include "OrderCache.h"
+
+//Orders and matching size of one security, as of the publish that last changed it.
+struct SecuritySnapshot
+{
+  vector<Order> orders{};
+  unsigned int matchingSize{0};
+};
+
+/* Immutable point in time view of a book, per security. The securities are hashed into about
+sqrt(securities) buckets; publishing rebuilds only the securities mutated since the previous
+publish and copies only their buckets, the other buckets are shared with the previous snapshot. */
+struct BookSnapshot
+{
+  using Bucket = unordered_map<string, shared_ptr<const SecuritySnapshot>>;
+
+  unsigned long long version{0};
+  size_t orderCount{0};
+  size_t securityCount{0};
+  vector<shared_ptr<const Bucket>> buckets{};
+
+  //Purpose: bucket of a security among n (a power of two).
+  static size_t bucketOf(const string& securityId, size_t n) { return hash<string>{}(securityId) & (n - 1); }
+
+  //Purpose: the security's orders and matching size, nullptr when it has no orders.
+  const SecuritySnapshot* security(const string& securityId) const
+  {
+    auto& bucket = *buckets[bucketOf(securityId, buckets.size())];
+    auto it = bucket.find(securityId);
+    return it == bucket.end() ? nullptr : it->second.get();
+  }
+  unsigned int getMatchingSizeForSecurity(const string& securityId) const
+  {
+    auto sec = security(securityId);
+    return sec ? sec->matchingSize : 0;
+  }
+  vector<Order> allOrders() const
+  {
+    vector<Order> all{};
+    all.reserve(orderCount);
+    for (auto& bucket : buckets)
+    {
+      for (auto& sec : *bucket) all.insert(all.end(), sec.second->orders.begin(), sec.second->orders.end());
+    }
+    return all;
+  }
+};
+
+/* Epoch based reclamation for the published snapshots.
+A reader announces the global epoch in a free slot before loading the current pointer and clears
+the slot when done. The writer swaps the pointer, retires the old object tagged with the epoch
+of the swap and then bumps the epoch: a reader that may still see the old object announced an
+epoch <= that tag, so the object is freed once no slot holds such an epoch. Readers never wait
+for the writer and write nothing shared but their own slot; there are Slots slots though, so past
+Slots concurrent readers a reader spins (yielding) until one frees up. */
+template <typename T, size_t Slots = 64>
+class EpochReclaimer
+{
+  atomic<unsigned long long> epoch{1};
+  atomic<unsigned long long> slots[Slots]{};
+  vector<pair<unsigned long long, const T*>> retired{};
+
+public:
+  ~EpochReclaimer()
+  {
+    for (auto& r : retired) delete r.second;
+  }
+
+  //Reader side: returns the slot to pass to leave().
+  size_t enter()
+  {
+    for (size_t i = 0; ; i = (i + 1) % Slots)
+    {
+      auto announced = epoch.load();
+      unsigned long long freeSlot = 0;
+      if (slots[i].compare_exchange_strong(freeSlot, announced)) return i;
+      if (i == Slots - 1) this_thread::yield();
+    }
+  }
+  void leave(size_t slot) { slots[slot].store(0); }
+
+  //Writer side (single writer): old is no longer reachable through the published pointer.
+  void retire(const T* old)
+  {
+    if (!old) return;
+    retired.emplace_back(epoch.load(), old);
+    epoch.fetch_add(1);
+    reclaim();
+  }
+  void reclaim()
+  {
+    auto oldestReader = ~0ull;
+    for (auto& slot : slots)
+    {
+      auto announced = slot.load();
+      if (announced) oldestReader = min(oldestReader, announced);
+    }
+    size_t kept = 0;
+    for (auto& r : retired)
+    {
+      if (r.first < oldestReader) delete r.second;
+      else retired[kept++] = r;
+    }
+    retired.resize(kept);
+  }
+  size_t pending() const { return retired.size(); }
+};
+
+/* Read mostly OrderCacheInterface. Writers mutate a private OrderCache (serialized among
+themselves by a writer mutex) and publish an immutable BookSnapshot every publishEvery
+mutations or on publish(). read() pins the last published snapshot without taking any lock,
+for as long as the returned view lives, so matching and enumeration are against one consistent
+version of the book; it is stale by up to publishEvery - 1 mutations. The OrderCacheInterface
+reads see every mutation made before them: they publish first when a mutation is pending, so
+they only take the lock after a write. Superseded snapshots are reclaimed by epochs. */
+class SnapshotOrderCache : public OrderCacheInterface
+{
+  //Publishing only brings the snapshot up to the book, so the const reads may do it.
+  mutable mutex writer{};
+  mutable OrderCache cache{};
+  size_t publishEvery;
+  mutable atomic<size_t> unpublished{0};
+  mutable unsigned long long version{0};
+  mutable unordered_set<string> dirty{};
+
+  mutable atomic<const BookSnapshot*> current{nullptr};
+  mutable EpochReclaimer<BookSnapshot> reclaimer{};
+
+  //Purpose: rehash the securities into n buckets (the SecuritySnapshots themselves are shared).
+  static void rebucket(BookSnapshot& snapshot, size_t n)
+  {
+    vector<shared_ptr<BookSnapshot::Bucket>> buckets(n);
+    for (auto& bucket : buckets) bucket = make_shared<BookSnapshot::Bucket>();
+    for (auto& bucket : snapshot.buckets)
+    {
+      for (auto& sec : *bucket) (*buckets[BookSnapshot::bucketOf(sec.first, n)])[sec.first] = sec.second;
+    }
+    snapshot.buckets.assign(buckets.begin(), buckets.end());
+  }
+  //Purpose: called with the writer mutex held.
+  void publishLocked() const
+  {
+    auto previous = current.load();
+    auto snapshot = new BookSnapshot{};
+    snapshot->version = ++version;
+    snapshot->orderCount = cache.size();
+    snapshot->securityCount = previous ? previous->securityCount : 0;
+    if (previous) snapshot->buckets = previous->buckets;
+    else rebucket(*snapshot, 16);
+
+    //Each bucket holding a dirty security is copied once, the others stay shared.
+    unordered_map<size_t, shared_ptr<BookSnapshot::Bucket>> copied{};
+    for (auto& secId : dirty)
+    {
+      auto b = BookSnapshot::bucketOf(secId, snapshot->buckets.size());
+      auto& bucket = copied[b];
+      if (!bucket)
+      {
+        bucket = make_shared<BookSnapshot::Bucket>(*snapshot->buckets[b]);
+        snapshot->buckets[b] = bucket;
+      }
+      auto sec = make_shared<SecuritySnapshot>();
+      cache.forEachOrder(OrderFilter{secId, {}, {}}, [&](const OrderView& v) { sec->orders.push_back(v.toOrder()); });
+      if (sec->orders.empty())
+      {
+        snapshot->securityCount -= bucket->erase(secId);
+        continue;
+      }
+      sec->matchingSize = cache.getMatchingSizeForSecurity(secId);
+      auto& slot = (*bucket)[secId];
+      snapshot->securityCount += slot == nullptr;
+      slot = std::move(sec);
+    }
+    //Doubling once the buckets average more entries than there are buckets keeps both near sqrt(securities).
+    auto n = snapshot->buckets.size();
+    if (snapshot->securityCount > n * n) rebucket(*snapshot, n * 2);
+    dirty.clear();
+    unpublished = 0;
+    reclaimer.retire(current.exchange(snapshot));
+  }
+  void mutated()
+  {
+    if (unpublished.fetch_add(1) + 1 >= publishEvery) publishLocked();
+  }
+  //Purpose: publish the pending mutations, if any, so a read sees every mutation made before it.
+  void publishPending() const
+  {
+    if (unpublished.load() == 0) return;
+    lock_guard<mutex> lock{writer};
+    if (unpublished.load() != 0) publishLocked();
+  }
+
+public:
+  //Pins a snapshot: the BookSnapshot stays alive and unchanged until the view is destroyed.
+  class ReadView
+  {
+    EpochReclaimer<BookSnapshot>* reclaimer;
+    size_t slot;
+    const BookSnapshot* snapshot;
+
+  public:
+    ReadView(EpochReclaimer<BookSnapshot>* r, const atomic<const BookSnapshot*>& current)
+      : reclaimer(r), slot(r->enter()), snapshot(current.load()) {}
+    ~ReadView() { if (reclaimer) reclaimer->leave(slot); }
+    ReadView(ReadView&& o) : reclaimer(o.reclaimer), slot(o.slot), snapshot(o.snapshot) { o.reclaimer = nullptr; }
+    ReadView(const ReadView&) = delete;
+    ReadView& operator=(const ReadView&) = delete;
+
+    const BookSnapshot& operator*() const { return *snapshot; }
+    const BookSnapshot* operator->() const { return snapshot; }
+  };
+
+  explicit SnapshotOrderCache(size_t publishEvery = 256) : publishEvery(max<size_t>(publishEvery, 1))
+  {
+    publishLocked();
+  }
+  ~SnapshotOrderCache()
+  {
+    delete current.load();
+  }
+
+  ReadView read() const
+  {
+    return ReadView{&reclaimer, current};
+  }
+  void publish()
+  {
+    lock_guard<mutex> lock{writer};
+    publishLocked();
+  }
+
+  void addOrder(Order o) override
+  {
+    lock_guard<mutex> lock{writer};
+    auto before = cache.size();
+    auto secId = o.securityId();
+    cache.addOrder(std::move(o));
+    if (cache.size() == before) return;
+    dirty.insert(std::move(secId));
+    mutated();
+  }
+  void cancelOrder(const std::string& orderId) override
+  {
+    lock_guard<mutex> lock{writer};
+    if (!cache.hasOrder(orderId)) return;
+    dirty.insert(cache.getOrder(orderId).securityId());
+    cache.cancelOrder(orderId);
+    mutated();
+  }
+  void cancelOrdersForUser(const std::string& user) override
+  {
+    lock_guard<mutex> lock{writer};
+    auto before = cache.size();
+    cache.forEachOrder(OrderFilter{{}, user, {}}, [&](const OrderView& v) { dirty.emplace(v.securityId); });
+    cache.cancelOrdersForUser(user);
+    if (cache.size() != before) mutated();
+  }
+  void cancelOrdersForSecIdWithMinimumQty(const std::string& securityId, unsigned int minQty) override
+  {
+    lock_guard<mutex> lock{writer};
+    auto before = cache.size();
+    cache.cancelOrdersForSecIdWithMinimumQty(securityId, minQty);
+    if (cache.size() == before) return;
+    dirty.insert(securityId);
+    mutated();
+  }
+
+  //Served from a snapshot holding every mutation made before the call.
+  unsigned int getMatchingSizeForSecurity(const std::string& securityId) override
+  {
+    publishPending();
+    return read()->getMatchingSizeForSecurity(securityId);
+  }
+  //Served from a snapshot holding every mutation made before the call.
+  vector<Order> getAllOrders() const override
+  {
+    publishPending();
+    return read()->allOrders();
+  }
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <deque>
+#include <string>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <memory_resource>
+
+using Symbol = std::uint32_t;
+
+/* Interning table: every distinct name gets a dense 32 bit id, handed out in order of first sight.
+Names are stored once in a deque (references stay valid as it grows) and the reverse index is
+keyed by views into them, so a lookup by string_view needs no temporary string. Ids are never
+recycled: securities, users and companies are few compared to orders.
+Moving a table into one with another memory resource copies the names, so the reverse index
+is rebuilt on move assignment rather than left pointing into the old strings. */
+class SymbolTable
+{
+  std::pmr::deque<std::pmr::string> names;
+  std::pmr::unordered_map<std::string_view, Symbol> ids;
+
+public:
+  static constexpr Symbol npos = ~Symbol{0};
+
+  explicit SymbolTable(std::pmr::memory_resource* r = std::pmr::get_default_resource()) : names(r), ids(r) {}
+  SymbolTable(SymbolTable&&) = default;
+  SymbolTable& operator=(SymbolTable&& other)
+  {
+    names = std::move(other.names);
+    ids.clear();
+    for (Symbol id = 0; id < names.size(); ++id) ids.emplace(names[id], id);
+    other.names.clear();
+    other.ids.clear();
+    return *this;
+  }
+
+  Symbol intern(std::string_view name)
+  {
+    auto it = ids.find(name);
+    if (it != ids.end()) return it->second;
+
+    auto id = static_cast<Symbol>(names.size());
+    names.emplace_back(name);
+    ids.emplace(names.back(), id);
+    return id;
+  }
+  //Purpose: lookup without interning, npos when the name was never seen.
+  Symbol find(std::string_view name) const
+  {
+    auto it = ids.find(name);
+    return it == ids.end() ? npos : it->second;
+  }
+  std::string_view name(Symbol id) const { return names[id]; }
+  size_t size() const { return names.size(); }
+};
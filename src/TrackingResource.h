@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+
+/* memory_resource that forwards to an upstream resource and keeps count of the bytes it
+currently holds. Give each structure its own tracker over a shared upstream and the counts
+tell which structure the memory goes to. The counts are the bytes asked for, what the
+upstream rounds them up to is not seen here.
+Not thread safe, like the structures it serves. */
+class TrackingResource : public std::pmr::memory_resource
+{
+  std::pmr::memory_resource* upstream;
+  size_t held{0};
+
+  void* do_allocate(size_t bytes, size_t alignment) override
+  {
+    auto p = upstream->allocate(bytes, alignment);
+    held += bytes;
+    return p;
+  }
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override
+  {
+    upstream->deallocate(p, bytes, alignment);
+    held -= bytes;
+  }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+  {
+    return this == &other;
+  }
+
+public:
+  explicit TrackingResource(std::pmr::memory_resource* r = std::pmr::get_default_resource()) : upstream(r) {}
+  TrackingResource(const TrackingResource&) = delete;
+  TrackingResource& operator=(const TrackingResource&) = delete;
+
+  size_t bytes() const { return held; }
+};
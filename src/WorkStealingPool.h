@@ -0,0 +1,142 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+/* Fixed size worker pool for data parallel loops.
+parallelFor() cuts [0, n) into chunks that are dealt round robin to one deque per worker.
+A worker pops chunks from the back of its own deque and, once it runs dry, steals from the
+front of the others, so a few expensive chunks don't leave the rest of the pool idle.
+The calling thread takes part as worker 0, a pool of size 1 runs everything inline. */
+class WorkStealingPool
+{
+  using Body = std::function<void(size_t, size_t)>;
+
+  struct Task
+  {
+    const Body* body;
+    size_t begin;
+    size_t end;
+  };
+  struct Queue
+  {
+    std::mutex m;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues{};
+  std::vector<std::thread> threads{};
+
+  std::mutex m{};
+  std::condition_variable workCv{};
+  std::condition_variable doneCv{};
+  std::atomic<size_t> queued{0};
+  size_t remaining{0};
+  bool stop{false};
+
+  bool popOwn(size_t self, Task& task)
+  {
+    auto& q = *queues[self];
+    std::lock_guard<std::mutex> lock{q.m};
+    if (q.tasks.empty()) return false;
+    task = q.tasks.back();
+    q.tasks.pop_back();
+    return true;
+  }
+  bool steal(size_t self, Task& task)
+  {
+    for (size_t i = 1; i < queues.size(); ++i)
+    {
+      auto& q = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock{q.m};
+      if (q.tasks.empty()) continue;
+      task = q.tasks.front();
+      q.tasks.pop_front();
+      return true;
+    }
+    return false;
+  }
+  void runAvailable(size_t self)
+  {
+    Task task{};
+    while (popOwn(self, task) || steal(self, task))
+    {
+      queued.fetch_sub(1);
+      (*task.body)(task.begin, task.end);
+
+      std::lock_guard<std::mutex> lock{m};
+      if (--remaining == 0) doneCv.notify_all();
+    }
+  }
+  void workerLoop(size_t self)
+  {
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock{m};
+        workCv.wait(lock, [&]{ return stop || queued.load() > 0; });
+        if (stop) return;
+      }
+      runAvailable(self);
+    }
+  }
+
+public:
+  explicit WorkStealingPool(size_t workers = std::thread::hardware_concurrency())
+  {
+    if (workers == 0) workers = 1;
+    for (size_t i = 0; i < workers; ++i) queues.emplace_back(new Queue{});
+    for (size_t i = 1; i < workers; ++i) threads.emplace_back([this, i]{ workerLoop(i); });
+  }
+  ~WorkStealingPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock{m};
+      stop = true;
+    }
+    workCv.notify_all();
+    for (auto& t : threads) t.join();
+  }
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  size_t size() const { return queues.size(); }
+
+  //Run body(begin, end) over [0, n) in chunks of at most grain items, returns once all chunks ran.
+  //One parallelFor at a time: the pool is meant to be driven by a single owner thread.
+  void parallelFor(size_t n, size_t grain, const Body& body)
+  {
+    if (n == 0) return;
+    if (grain == 0) grain = 1;
+    if (queues.size() == 1 || n <= grain)
+    {
+      body(0, n);
+      return;
+    }
+
+    auto chunks = (n + grain - 1) / grain;
+    {
+      std::lock_guard<std::mutex> lock{m};
+      remaining = chunks;
+      queued.fetch_add(chunks);
+    }
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+      auto begin = chunk * grain;
+      auto& q = *queues[chunk % queues.size()];
+      std::lock_guard<std::mutex> lock{q.m};
+      q.tasks.push_back(Task{&body, begin, std::min(n, begin + grain)});
+    }
+    workCv.notify_all();
+
+    runAvailable(0);
+
+    std::unique_lock<std::mutex> lock{m};
+    doneCv.wait(lock, [&]{ return remaining == 0; });
+  }
+};